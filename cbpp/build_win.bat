@@ -59,8 +59,17 @@ set OUT=%~dp0/bin
 cl.exe %SRC%/Base.cpp /EHsc /nologo /Fo%OUT%/Base.obj /c %CL_FLAGS%
 cl.exe %SRC%/cbpp.cpp /EHsc /nologo /Fo%OUT%/cbpp.obj /c %CL_FLAGS%
 cl.exe %SRC%/ComputeProcessor.cpp /EHsc /nologo /Fo%OUT%/ComputeProcessor.obj /c %CL_FLAGS%
+cl.exe %SRC%/IncludeCache.cpp /EHsc /nologo /Fo%OUT%/IncludeCache.obj /c %CL_FLAGS%
+cl.exe %SRC%/KernelParamsWriter.cpp /EHsc /nologo /Fo%OUT%/KernelParamsWriter.obj /c %CL_FLAGS%
+cl.exe %SRC%/KernelReflection.cpp /EHsc /nologo /Fo%OUT%/KernelReflection.obj /c %CL_FLAGS%
+cl.exe %SRC%/OutputCache.cpp /EHsc /nologo /Fo%OUT%/OutputCache.obj /c %CL_FLAGS%
+cl.exe %SRC%/PrecompiledHeader.cpp /EHsc /nologo /Fo%OUT%/PrecompiledHeader.obj /c %CL_FLAGS%
 cl.exe %SRC%/TextureTransform.cpp /EHsc /nologo /Fo%OUT%/TextureTransform.obj /c %CL_FLAGS%
+cl.exe %SRC%/TextureTypes.cpp /EHsc /nologo /Fo%OUT%/TextureTypes.obj /c %CL_FLAGS%
 cl.exe %SRC%/PrologueTransform.cpp /EHsc /nologo /Fo%OUT%/PrologueTransform.obj /c %CL_FLAGS%
+cl.exe %SRC%/Server.cpp /EHsc /nologo /Fo%OUT%/Server.obj /c %CL_FLAGS%
+cl.exe %SRC%/SourceMap.cpp /EHsc /nologo /Fo%OUT%/SourceMap.obj /c %CL_FLAGS%
+cl.exe %SRC%/StructLayout.cpp /EHsc /nologo /Fo%OUT%/StructLayout.obj /c %CL_FLAGS%
 cl.exe %SRC%/fcpp.c /EHsc /nologo /Fo%OUT%/fcpp.obj /c %CL_FLAGS%
 cl.exe %DEP%/ComputeParser.c /EHsc /nologo /Fo%OUT%/ComputeParser.obj /c %CL_FLAGS%
-link.exe %LINK_FLAGS% /LIBPATH:"%WINDOWS_SDK_DIR%lib" /OUT:%OUT%/cbpp.exe %OUT%/Base %OUT%/cbpp %OUT%/ComputeProcessor %OUT%/TextureTransform %OUT%/PrologueTransform %OUT%/fcpp %OUT%/ComputeParser
+link.exe %LINK_FLAGS% /LIBPATH:"%WINDOWS_SDK_DIR%lib" /OUT:%OUT%/cbpp.exe %OUT%/Base %OUT%/cbpp %OUT%/ComputeProcessor %OUT%/IncludeCache %OUT%/KernelParamsWriter %OUT%/KernelReflection %OUT%/OutputCache %OUT%/PrecompiledHeader %OUT%/TextureTransform %OUT%/TextureTypes %OUT%/PrologueTransform %OUT%/Server %OUT%/SourceMap %OUT%/StructLayout %OUT%/fcpp %OUT%/ComputeParser
@@ -0,0 +1,272 @@
+
+//
+// Layout of the kernel parameter file written by cbpp with -output_bin, along with functions for finding
+// a kernel's parameters in it. Every kernel definition is listed with all of its parameters, in order,
+// and the offset of each within the block of arguments so that the block can be built with memcpy.
+// Each parameter also has the index of the argument it's passed as on the target, so that OpenCL image
+// arguments can be bound with clSetKernelArg from the tables.
+//
+// All fields are fixed-width and little-endian, with every table aligned to 8 bytes from the start of
+// the file so that it can be mapped into memory and used in place. Function names are found through an
+// open-addressed hash table of power-of-two size, keyed on cbppKernelParams_Hash and probed linearly.
+// Strings are null-terminated, 4-byte aligned and referenced by their offset from the start of the file.
+//
+// The version is changed whenever the layout changes. Big-endian hosts need to swap each field.
+//
+
+#ifndef INCLUDED_CBPP_KERNEL_PARAMS_H
+#define INCLUDED_CBPP_KERNEL_PARAMS_H
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+#ifdef __cplusplus
+	#define CBPP_KERNEL_PARAMS_FN inline
+#else
+	#define CBPP_KERNEL_PARAMS_FN static
+#endif
+
+
+#define CBPP_KERNEL_PARAMS_MAGIC "cbkparam"
+#define CBPP_KERNEL_PARAMS_VERSION 3
+
+
+// Size, alignment and offset of parameters whose type cbpp doesn't know the layout of. Every parameter
+// after one of these also has an unknown offset.
+#define CBPP_KERNEL_PARAMS_UNKNOWN 0xFFFFFFFF
+
+
+// Argument index of parameters that aren't passed as kernel arguments, such as CUDA textures which are
+// bound to the global variable named by the parameter instead
+#define CBPP_KERNEL_PARAMS_NO_ARG 0xFFFFFFFF
+
+
+// Targets the file can be generated for
+#define CBPP_KERNEL_PARAMS_TARGET_CUDA 1
+#define CBPP_KERNEL_PARAMS_TARGET_OPENCL 2
+
+
+// Parameter kinds
+#define CBPP_KERNEL_PARAM_VALUE 'v'
+#define CBPP_KERNEL_PARAM_POINTER 'p'
+#define CBPP_KERNEL_PARAM_TEXTURE 't'
+#define CBPP_KERNEL_PARAM_SURFACE 's'
+
+
+// Parameter address spaces, with zero for none
+#define CBPP_KERNEL_PARAM_GLOBAL 'g'
+#define CBPP_KERNEL_PARAM_CONSTANT 'c'
+
+
+typedef struct cbppKernelParamsHeader
+{
+	// CBPP_KERNEL_PARAMS_MAGIC, without its null terminator
+	char magic[8];
+
+	uint32_t version;
+	uint32_t file_size;
+
+	// CBPP_KERNEL_PARAMS_TARGET_CUDA/OPENCL
+	uint32_t target;
+
+	// cbppKernelFunction table, sorted by name
+	uint32_t nb_functions;
+	uint32_t functions_offset;
+
+	// cbppKernelParam table, with each function's parameters stored together
+	uint32_t nb_params;
+	uint32_t params_offset;
+
+	// Function index plus one for each slot, with zero marking empty slots
+	uint32_t nb_hash_slots;
+	uint32_t hash_slots_offset;
+
+	uint32_t strings_size;
+	uint32_t strings_offset;
+} cbppKernelParamsHeader;
+
+
+typedef struct cbppKernelFunction
+{
+	uint32_t name_offset;
+	uint32_t name_hash;
+
+	// Range of the function's parameters in the parameter table
+	uint32_t first_param;
+	uint32_t nb_params;
+
+	// Number of arguments the kernel takes on the target
+	uint32_t nb_args;
+
+	// Size and alignment of the block of all arguments
+	uint32_t args_size;
+	uint32_t args_alignment;
+} cbppKernelFunction;
+
+
+typedef struct cbppKernelParam
+{
+	uint32_t name_offset;
+
+	// Type as written in the source, without its address space
+	uint32_t type_offset;
+
+	// Name of the global variable a CUDA texture or surface must be bound to, zero if there isn't one
+	uint32_t global_name_offset;
+
+	// Layout within the block of arguments, with a zero size for parameters that aren't passed as
+	// arguments on the target, such as CUDA textures
+	uint32_t size;
+	uint32_t alignment;
+	uint32_t offset;
+
+	// Index of the kernel argument the parameter is passed as, or CBPP_KERNEL_PARAMS_NO_ARG
+	uint32_t arg_index;
+
+	// CBPP_KERNEL_PARAM_VALUE/POINTER/TEXTURE/SURFACE
+	uint8_t kind;
+
+	// CBPP_KERNEL_PARAM_GLOBAL/CONSTANT or zero
+	uint8_t address_space;
+
+	// Texture and surface dimensions
+	uint8_t dimensions;
+
+	// 'u' for element reads, 'n' for normalised float reads and zero for everything but textures
+	uint8_t read_type;
+} cbppKernelParam;
+
+
+// FNV-1a hash of a null-terminated function name
+CBPP_KERNEL_PARAMS_FN uint32_t cbppKernelParams_Hash(const char* name)
+{
+	uint32_t hash = 2166136261u;
+	while (*name != 0)
+	{
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+
+// Checks that the offset is of a string that starts and ends within the string table
+CBPP_KERNEL_PARAMS_FN int cbppKernelParams_IsString(const cbppKernelParamsHeader* header, uint32_t offset)
+{
+	const char* strings = (const char*)header + header->strings_offset;
+	if (offset < header->strings_offset || offset - header->strings_offset >= header->strings_size)
+		return 0;
+	offset -= header->strings_offset;
+	return memchr(strings + offset, 0, header->strings_size - offset) != NULL;
+}
+
+
+// Checks the file header, the table bounds, the parameter range of every function and every string
+// offset, returning NULL if the file can't be used. Lookups in a file that passes stay within it.
+CBPP_KERNEL_PARAMS_FN const cbppKernelParamsHeader* cbppKernelParams_Header(const void* data, size_t size)
+{
+	const cbppKernelParamsHeader* header = (const cbppKernelParamsHeader*)data;
+	const cbppKernelFunction* functions;
+	const cbppKernelParam* params;
+	uint32_t i;
+
+	if (size < sizeof(cbppKernelParamsHeader))
+		return NULL;
+	if (memcmp(header->magic, CBPP_KERNEL_PARAMS_MAGIC, sizeof(header->magic)) != 0)
+		return NULL;
+	if (header->version != CBPP_KERNEL_PARAMS_VERSION || header->file_size > size)
+		return NULL;
+
+	// Tables must fit within the file and hash slot counts must be a power of two
+	if (header->functions_offset + (uint64_t)header->nb_functions * sizeof(cbppKernelFunction) > header->file_size ||
+		header->params_offset + (uint64_t)header->nb_params * sizeof(cbppKernelParam) > header->file_size ||
+		header->hash_slots_offset + (uint64_t)header->nb_hash_slots * sizeof(uint32_t) > header->file_size ||
+		header->strings_offset + (uint64_t)header->strings_size > header->file_size)
+		return NULL;
+	if (header->nb_hash_slots == 0 || (header->nb_hash_slots & (header->nb_hash_slots - 1)) != 0)
+		return NULL;
+
+	// Functions must name parameters within the parameter table
+	functions = (const cbppKernelFunction*)((const char*)header + header->functions_offset);
+	for (i = 0; i < header->nb_functions; i++)
+	{
+		if ((uint64_t)functions[i].first_param + functions[i].nb_params > header->nb_params)
+			return NULL;
+		if (!cbppKernelParams_IsString(header, functions[i].name_offset))
+			return NULL;
+	}
+
+	// Parameters without a global have a zero global name offset
+	params = (const cbppKernelParam*)((const char*)header + header->params_offset);
+	for (i = 0; i < header->nb_params; i++)
+	{
+		if (!cbppKernelParams_IsString(header, params[i].name_offset) ||
+			!cbppKernelParams_IsString(header, params[i].type_offset))
+			return NULL;
+		if (params[i].global_name_offset != 0 && !cbppKernelParams_IsString(header, params[i].global_name_offset))
+			return NULL;
+	}
+
+	return header;
+}
+
+
+CBPP_KERNEL_PARAMS_FN const char* cbppKernelParams_String(const cbppKernelParamsHeader* header, uint32_t offset)
+{
+	return (const char*)header + offset;
+}
+
+
+// Returns NULL if there is no kernel definition with the name
+CBPP_KERNEL_PARAMS_FN const cbppKernelFunction* cbppKernelParams_FindFunction(const cbppKernelParamsHeader* header, const char* name)
+{
+	const char* base = (const char*)header;
+	const uint32_t* slots = (const uint32_t*)(base + header->hash_slots_offset);
+	const cbppKernelFunction* functions = (const cbppKernelFunction*)(base + header->functions_offset);
+	uint32_t mask = header->nb_hash_slots - 1;
+	uint32_t hash = cbppKernelParams_Hash(name);
+	uint32_t i;
+
+	for (i = 0; i < header->nb_hash_slots; i++)
+	{
+		uint32_t slot = slots[(hash + i) & mask];
+		const cbppKernelFunction* function;
+		if (slot == 0 || slot > header->nb_functions)
+			return NULL;
+
+		function = functions + slot - 1;
+		if (function->name_hash == hash && strcmp(base + function->name_offset, name) == 0)
+			return function;
+	}
+
+	return NULL;
+}
+
+
+CBPP_KERNEL_PARAMS_FN const cbppKernelParam* cbppKernelParams_Params(const cbppKernelParamsHeader* header, const cbppKernelFunction* function)
+{
+	const cbppKernelParam* params = (const cbppKernelParam*)((const char*)header + header->params_offset);
+	return params + function->first_param;
+}
+
+
+// Returns NULL if the kernel has no parameter with the name
+CBPP_KERNEL_PARAMS_FN const cbppKernelParam* cbppKernelParams_FindParam(const cbppKernelParamsHeader* header, const cbppKernelFunction* function, const char* name)
+{
+	const cbppKernelParam* params = cbppKernelParams_Params(header, function);
+	uint32_t i;
+
+	for (i = 0; i < function->nb_params; i++)
+	{
+		if (strcmp(cbppKernelParams_String(header, params[i].name_offset), name) == 0)
+			return params + i;
+	}
+
+	return NULL;
+}
+
+
+#endif
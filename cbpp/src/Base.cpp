@@ -2,11 +2,24 @@
 #include "Base.h"
 
 #include <string>
+#include <algorithm>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 
 #ifdef _WIN32
 #define WIN_32_LEAN_AND_MEAN
 #include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <cerrno>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <utime.h>
 #endif
 
 
@@ -26,6 +39,26 @@ std::string GetExecutableFullPath()
 	return buffer;
 }
 
+#else
+
+std::string GetCurrentWorkingDirectory()
+{
+	char buffer[512];
+	if (getcwd(buffer, sizeof(buffer)) == 0)
+		return "";
+	return buffer;
+}
+
+std::string GetExecutableFullPath()
+{
+	char buffer[512];
+	ssize_t length = readlink("/proc/self/exe", buffer, sizeof(buffer) - 1);
+	if (length < 0)
+		return "";
+	buffer[length] = 0;
+	return buffer;
+}
+
 #endif
 
 
@@ -69,8 +102,8 @@ bool IsPathAbsolute(const std::string& path)
 	if (len == 0)
 		return false;
 
-	// Start with a single backslash is absolute for current drive
-	if (path[0] == '\\')
+	// Start with a single slash is absolute for current drive
+	if (path[0] == '\\' || path[0] == '/')
 		return true;
 
 	// Drive specified
@@ -81,6 +114,40 @@ bool IsPathAbsolute(const std::string& path)
 }
 
 
+std::string GetAbsolutePath(std::string path)
+{
+	if (!IsPathAbsolute(path))
+	{
+		std::string cwd = GetCurrentWorkingDirectory();
+		path = JoinPaths(cwd, path);
+		std::replace(path.begin(), path.end(), '\\', '/');
+	}
+
+	return path;
+}
+
+
+std::vector<std::string> SplitString(const std::string& str, char separator)
+{
+	std::vector<std::string> parts;
+
+	size_t start = 0;
+	while (start <= str.length())
+	{
+		// Locate the end of this part, which may be the end of the string
+		size_t end = str.find(separator, start);
+		if (end == std::string::npos)
+			end = str.length();
+
+		if (end != start)
+			parts.push_back(str.substr(start, end - start));
+		start = end + 1;
+	}
+
+	return parts;
+}
+
+
 File::File()
 	: fp(0)
 {
@@ -139,6 +206,254 @@ bool LoadFileData(const char* filename, std::vector<char>& file_data)
 }
 
 
+bool SaveFileData(const char* filename, const std::vector<char>& file_data)
+{
+	File file;
+	if (!Open(file, filename, "wb"))
+		return false;
+
+	return fwrite(file_data.data(), 1, file_data.size(), file.fp) == file_data.size();
+}
+
+
+namespace
+{
+	bool RenameOverFile(const std::string& src_filename, const std::string& dest_filename)
+	{
+#ifdef _WIN32
+		// rename() fails on Windows when the destination exists
+		return MoveFileExA(src_filename.c_str(), dest_filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(src_filename.c_str(), dest_filename.c_str()) == 0;
+#endif
+	}
+
+
+	int GetProcessID()
+	{
+#ifdef _WIN32
+		return _getpid();
+#else
+		return getpid();
+#endif
+	}
+}
+
+
+bool WriteFileIfChanged(const std::string& filename, const std::vector<char>& file_data)
+{
+	// Compare against any existing file, only reading it when the sizes match
+	FileInfo info;
+	if (GetFileInfo(filename, info) && info.size == file_data.size())
+	{
+		std::vector<char> old_file_data;
+		if (LoadFileData(filename.c_str(), old_file_data) && old_file_data == file_data)
+			return true;
+	}
+
+	// Write alongside the destination so that the rename doesn't cross file systems
+	char suffix[32];
+	sprintf(suffix, ".tmp%d", GetProcessID());
+	std::string tmp_filename = filename + suffix;
+	if (!SaveFileData(tmp_filename.c_str(), file_data) || !RenameOverFile(tmp_filename, filename))
+	{
+		remove(tmp_filename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+
+FileInfo::FileInfo()
+	: size(0)
+	, modified_time(0)
+	, modified_time_ns(0)
+{
+}
+
+
+namespace
+{
+	bool GetFileInfo(const std::string& path, FileInfo& info, bool& is_directory)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			return false;
+
+		info.path = path;
+		info.size = st.st_size;
+		info.modified_time = st.st_mtime;
+#if defined(_WIN32)
+		info.modified_time_ns = 0;
+#elif defined(__APPLE__)
+		info.modified_time_ns = (cmpU32)st.st_mtimespec.tv_nsec;
+#else
+		info.modified_time_ns = (cmpU32)st.st_mtim.tv_nsec;
+#endif
+		is_directory = (st.st_mode & S_IFMT) == S_IFDIR;
+		return true;
+	}
+}
+
+
+bool GetFileInfo(const std::string& path, FileInfo& info)
+{
+	bool is_directory;
+	return GetFileInfo(path, info, is_directory);
+}
+
+
+#ifdef _WIN32
+
+bool ListDirectory(const std::string& path, std::vector<FileInfo>& files)
+{
+	WIN32_FIND_DATAA find_data;
+	HANDLE handle = FindFirstFileA(JoinPaths(path, "*").c_str(), &find_data);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Gather info for all files, skipping sub-directories
+	do
+	{
+		FileInfo info;
+		if (!(find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && GetFileInfo(JoinPaths(path, find_data.cFileName), info))
+			files.push_back(info);
+	} while (FindNextFileA(handle, &find_data));
+
+	FindClose(handle);
+	return true;
+}
+
+
+bool MakeDirectory(const std::string& path)
+{
+	return _mkdir(path.c_str()) == 0;
+}
+
+
+bool TouchFile(const std::string& path)
+{
+	return _utime(path.c_str(), NULL) == 0;
+}
+
+
+FileLock::FileLock()
+	: handle(INVALID_HANDLE_VALUE)
+{
+}
+
+
+FileLock::~FileLock()
+{
+	// Closing the handle releases the lock
+	if (handle != INVALID_HANDLE_VALUE)
+		CloseHandle(handle);
+}
+
+
+bool Lock(FileLock& lock, const std::string& filename)
+{
+	if (lock.handle != INVALID_HANDLE_VALUE)
+		return false;
+
+	lock.handle = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (lock.handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	OVERLAPPED overlapped = { 0 };
+	return LockFileEx(lock.handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped) != 0;
+}
+
+#else
+
+bool ListDirectory(const std::string& path, std::vector<FileInfo>& files)
+{
+	DIR* dir = opendir(path.c_str());
+	if (dir == 0)
+		return false;
+
+	// Gather info for all files, skipping sub-directories
+	while (struct dirent* entry = readdir(dir))
+	{
+		FileInfo info;
+		bool is_directory;
+		if (GetFileInfo(JoinPaths(path, entry->d_name), info, is_directory) && !is_directory)
+			files.push_back(info);
+	}
+
+	closedir(dir);
+	return true;
+}
+
+
+bool MakeDirectory(const std::string& path)
+{
+	return mkdir(path.c_str(), 0777) == 0;
+}
+
+
+bool TouchFile(const std::string& path)
+{
+	return utime(path.c_str(), NULL) == 0;
+}
+
+
+FileLock::FileLock()
+	: fd(-1)
+{
+}
+
+
+FileLock::~FileLock()
+{
+	// Closing the file releases the lock
+	if (fd != -1)
+		close(fd);
+}
+
+
+bool Lock(FileLock& lock, const std::string& filename)
+{
+	if (lock.fd != -1)
+		return false;
+
+	lock.fd = open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+	if (lock.fd == -1)
+		return false;
+
+	// Keep waiting if a signal interrupts the wait
+	int result;
+	do
+	{
+		result = flock(lock.fd, LOCK_EX);
+	} while (result != 0 && errno == EINTR);
+	return result == 0;
+}
+
+#endif
+
+
+cmpU64 Hash64(const void* data, size_t size, cmpU64 seed)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	cmpU64 hash = seed;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+cmpU64 Hash64String(const std::string& str, cmpU64 seed)
+{
+	// Include the terminator so that consecutive strings can't run together
+	return Hash64(str.c_str(), str.length() + 1, seed);
+}
+
+
 Arguments::Arguments(int argc, const char* argv[])
 {
 	// Copy from the command-line into local storage
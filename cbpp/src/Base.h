@@ -3,7 +3,11 @@
 #define INCLUDED_BASE_H
 
 
+#include "../../lib/ComputeParser.h"
+
 #include <vector>
+#include <string>
+#include <ctime>
 
 
 //
@@ -15,6 +19,13 @@ std::string GetPathDrive(const std::string& path);
 std::string GetPathDirectory(const std::string& path);
 std::string JoinPaths(const std::string& p0, const std::string& p1);
 bool IsPathAbsolute(const std::string& path);
+std::string GetAbsolutePath(std::string path);
+
+
+//
+// Splits a string at each occurrence of the separator, discarding empty entries
+//
+std::vector<std::string> SplitString(const std::string& str, char separator);
 
 
 //
@@ -35,6 +46,66 @@ bool Open(File& file, const char* filename, const char* mode);
 size_t Size(const File& file);
 bool Read(const File& file, void* dest, size_t size);
 bool LoadFileData(const char* filename, std::vector<char>& file_data);
+bool SaveFileData(const char* filename, const std::vector<char>& file_data);
+
+// Leaves the file untouched if it already has the given contents, otherwise writes to a temporary
+// file that replaces the original with a rename so that readers never see partial output
+bool WriteFileIfChanged(const std::string& filename, const std::vector<char>& file_data);
+
+
+//
+// File system queries/modification that the C standard library doesn't cover
+//
+struct FileInfo
+{
+	FileInfo();
+
+	std::string path;
+	cmpU64 size;
+	time_t modified_time;
+
+	// Sub-second part of the modification time, where the platform records it
+	cmpU32 modified_time_ns;
+};
+bool GetFileInfo(const std::string& path, FileInfo& info);
+bool ListDirectory(const std::string& path, std::vector<FileInfo>& files);
+bool MakeDirectory(const std::string& path);
+bool TouchFile(const std::string& path);
+
+
+//
+// RAII lock shared with other processes, for serialising updates to a file that several runs write.
+// Locking waits for any other holder to release the lock, which happens when its FileLock is destroyed
+// or its process exits.
+//
+struct FileLock
+{
+	FileLock();
+	~FileLock();
+
+#ifdef _WIN32
+	void* handle;
+#else
+	int fd;
+#endif
+
+private:
+	// Non-copyable
+	FileLock(const FileLock&);
+	FileLock& operator = (const FileLock&);
+};
+
+// Locks the given file, which is created if it doesn't exist and left behind afterwards
+bool Lock(FileLock& lock, const std::string& filename);
+
+
+//
+// 64-bit FNV-1a hash for comparing file contents. Pass the result of a previous call as the seed
+// to continue hashing.
+//
+static const cmpU64 HASH64_SEED = 0xcbf29ce484222325ULL;
+cmpU64 Hash64(const void* data, size_t size, cmpU64 seed = HASH64_SEED);
+cmpU64 Hash64String(const std::string& str, cmpU64 seed = HASH64_SEED);
 
 
 
@@ -2,12 +2,18 @@
 #include "ComputeProcessor.h"
 
 #include <cassert>
+#include <cctype>
 #include <string>
+#include <algorithm>
+#include <unordered_map>
 
 
 // List of all registered transform descriptions
 static std::vector<TransformDescBase*> g_TransformDescs;
 
+// Ordinal spacing of tokens inserted between others
+static const cmpU64 INSERTED_TOKEN_ORDINAL_GAP = 1 << 16;
+
 
 TokenList::TokenList()
 	: first(0)
@@ -125,11 +131,49 @@ void TokenList::DeleteAll()
 }
 
 
-ComputeProcessor::ComputeProcessor(const ::Arguments& arguments, const std::string& input_filename, const std::vector<char>& file_data, ComputeTarget target)
+ComputeTarget ComputeTargetFromName(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), tolower);
+	if (name == "cuda")
+		return ComputeTarget_CUDA;
+	if (name == "opencl")
+		return ComputeTarget_OpenCL;
+	return ComputeTarget_None;
+}
+
+
+const char* ComputeTargetName(ComputeTarget target)
+{
+	switch (target)
+	{
+		case ComputeTarget_CUDA: return "cuda";
+		case ComputeTarget_OpenCL: return "opencl";
+		default: return "none";
+	}
+}
+
+
+bool GetCudaLongSize(const Arguments& args, cmpU32& size)
+{
+	size = sizeof(long);
+	if (!args.Have("-cuda_long_size"))
+		return true;
+
+	std::string long_size = args.GetProperty("-cuda_long_size");
+	if (long_size != "4" && long_size != "8")
+		return false;
+	size = long_size[0] - '0';
+	return true;
+}
+
+
+ComputeProcessor::ComputeProcessor(const ::Arguments& arguments, const std::string& input_filename, const std::vector<char>& file_data, const std::vector<TokenSpan>& token_spans, ComputeTarget target)
 	: m_Arguments(arguments)
 	, m_InputFilename(input_filename)
 	, m_FileData(file_data)
+	, m_TokenSpans(token_spans)
 	, m_Target(target)
+	, m_Source(0)
 	, m_LexerCursor(0)
 	, m_ParserCursor(0)
 	, m_RootNode(0)
@@ -139,6 +183,19 @@ ComputeProcessor::ComputeProcessor(const ::Arguments& arguments, const std::stri
 }
 
 
+ComputeProcessor::ComputeProcessor(const ComputeProcessor& source, ComputeTarget target)
+	: m_Arguments(source.m_Arguments)
+	, m_InputFilename(source.m_InputFilename)
+	, m_ExecutableDirectory(source.m_ExecutableDirectory)
+	, m_Target(target)
+	, m_Source(&source)
+	, m_LexerCursor(0)
+	, m_ParserCursor(0)
+	, m_RootNode(0)
+{
+}
+
+
 ComputeProcessor::~ComputeProcessor()
 {
 	// Destroy all transforms, assuming transform description list and allocate transforms lists are in sync
@@ -150,7 +207,13 @@ ComputeProcessor::~ComputeProcessor()
 		desc->delete_func(m_Transforms[i]);
 	}
 
-	// Destroy all tokens
+	// Destroy all tokens, including those of edits that were never applied
+	for (size_t i = 0; i < m_TokenEdits.size(); i++)
+	{
+		m_TokenEdits[i].tokens.DeleteAll();
+		if (m_TokenEdits[i].new_node != 0)
+			cmpNode_Destroy(m_TokenEdits[i].new_node);
+	}
 	m_Tokens.DeleteAll();
 
 	// Destroy all nodes
@@ -167,6 +230,9 @@ ComputeProcessor::~ComputeProcessor()
 
 bool ComputeProcessor::ParseFile()
 {
+	if (m_Source != 0)
+		return CloneParse();
+
 	const char* filename = m_InputFilename.c_str();
 	bool verbose = m_Arguments.Have("-verbose");
 
@@ -176,8 +242,27 @@ bool ComputeProcessor::ParseFile()
 		printf("Error creating lexer cursor: %s\n\n", cmpError_Text(&error));
 		return false;
 	}
-	while (cmpToken* token = cmpLexer_ConsumeToken(m_LexerCursor))
+	cmpU32 file_size = (cmpU32)m_FileData.size();
+	size_t span_index = 0;
+	while (true)
 	{
+		// Take the next span as it is once the lexer reaches it, stopping the lexer from reading into it
+		cmpToken* token;
+		cmpU32 position = cmpLexerCursor_Position(m_LexerCursor);
+		if (span_index < m_TokenSpans.size() && position == m_TokenSpans[span_index].start)
+		{
+			const TokenSpan& span = m_TokenSpans[span_index++];
+			cmpLexerCursor_SetLimit(m_LexerCursor, file_size);
+			token = cmpLexer_ConsumeKnownToken(m_LexerCursor, span.type, span.length);
+		}
+		else
+		{
+			cmpLexerCursor_SetLimit(m_LexerCursor, span_index < m_TokenSpans.size() ? m_TokenSpans[span_index].start : file_size);
+			token = cmpLexer_ConsumeToken(m_LexerCursor);
+		}
+		if (token == 0)
+			break;
+
 		m_Tokens.Add(token);
 		if (verbose)
 			printf("[0x%2x] %s %d\n", token->type, cmpTokenType_Name(token->type), token->length);
@@ -220,6 +305,113 @@ bool ComputeProcessor::ParseFile()
 }
 
 
+namespace
+{
+	typedef std::unordered_map<const cmpToken*, cmpToken*> TokenMap;
+
+
+	cmpNode* CloneNode(const cmpNode* source_node, const TokenMap& token_map)
+	{
+		cmpNode* node;
+		cmpError error = cmpNode_CreateEmpty(&node);
+		if (!cmpError_OK(&error))
+			throw error;
+
+		// Point at the equivalent tokens in the cloned list
+		node->type = source_node->type;
+		node->first_token = token_map.find(source_node->first_token)->second;
+		node->last_token = token_map.find(source_node->last_token)->second;
+
+		for (const cmpNode* child = source_node->first_child; child != 0; child = child->next_sibling)
+			cmpNode_AddChild(node, CloneNode(child, token_map));
+
+		return node;
+	}
+}
+
+
+bool ComputeProcessor::CloneParse()
+{
+	assert(m_Source != 0);
+	assert(m_Source->m_Transforms.empty());
+
+	if (m_Source->m_RootNode == 0)
+	{
+		printf("Error: Can't share the parse of a file that hasn't been parsed\n");
+		return false;
+	}
+
+	try
+	{
+		// Duplicate the token list, recording where each source token went. Token text isn't copied and
+		// remains owned by the source processor.
+		TokenMap token_map;
+		token_map[0] = 0;
+		for (const cmpToken* token = m_Source->m_Tokens.first; token != 0; token = token->next)
+		{
+			cmpToken* clone = m_Tokens.Add(token->type, token->start, token->length, token->line);
+			clone->hash = token->hash;
+			token_map[token] = clone;
+		}
+
+		// Rebuild the AST on top of the new tokens
+		cmpError error = cmpNode_CreateEmpty(&m_RootNode);
+		if (!cmpError_OK(&error))
+			throw error;
+		for (const cmpNode* child = m_Source->m_RootNode->first_child; child != 0; child = child->next_sibling)
+			cmpNode_AddChild(m_RootNode, CloneNode(child, token_map));
+	}
+	catch (const cmpError& error)
+	{
+		printf("Error: %s\n", error.text);
+		return false;
+	}
+
+	if (m_Arguments.Have("-verbose"))
+		cmpParser_LogNodes(m_RootNode, 0);
+
+	return true;
+}
+
+
+std::string ComputeProcessor::TargetProperty(const std::string& arg) const
+{
+	// Per-target values are listed in the same order as the targets they belong to
+	std::vector<std::string> values = SplitString(m_Arguments.GetProperty(arg), ',');
+	std::vector<std::string> targets = SplitString(m_Arguments.GetProperty("-target"), ',');
+	for (size_t i = 0; i < targets.size() && i < values.size(); i++)
+	{
+		if (ComputeTargetFromName(targets[i]) == m_Target)
+			return values[i];
+	}
+
+	return "";
+}
+
+
+cmpU32 ComputeProcessor::LongSize() const
+{
+	if (m_Target != ComputeTarget_CUDA)
+		return 8;
+
+	// Invalid sizes are rejected before any processing starts
+	cmpU32 size;
+	GetCudaLongSize(m_Arguments, size);
+	return size;
+}
+
+
+bool ComputeProcessor::IsInputToken(const cmpToken& token) const
+{
+	// Shared parses keep pointing at the text of the source
+	if (m_Source != 0)
+		return m_Source->IsInputToken(token);
+
+	const char* start = m_FileData.data();
+	return token.start >= start && token.start < start + m_FileData.size();
+}
+
+
 namespace
 {
 	bool VisitNode(const ComputeProcessor& processor, cmpNode* node, INodeVisitor* visitor)
@@ -268,15 +460,305 @@ cmpError ComputeProcessor::ApplyTransforms()
 	{
 		ITransform* transform = m_Transforms[i];
 		assert(transform != 0);
-		cmpError error = transform->Apply(*this);
-		if (!cmpError_OK(&error))
+		try
+		{
+			cmpError error = transform->Apply(*this);
+			if (!cmpError_OK(&error))
+				return error;
+		}
+		catch (const cmpError& error)
+		{
+			// Edits that break the rules, or fail to allocate, aren't always caught by the transform
 			return error;
+		}
+
+		ApplyRewrites();
 	}
 
 	return cmpError_CreateOK();
 }
 
 
+namespace
+{
+	cmpToken* FirstTokenInTree(cmpNode* node)
+	{
+		// Nodes own the tokens before those of their children
+		if (node->first_token != 0)
+			return node->first_token;
+
+		for (cmpNode* child = node->first_child; child != 0; child = child->next_sibling)
+		{
+			if (cmpToken* token = FirstTokenInTree(child))
+				return token;
+		}
+
+		return 0;
+	}
+
+
+	cmpToken* FirstTokenAfterTree(cmpNode* node)
+	{
+		// Search the siblings that follow, moving up to those of the parent when they have no tokens
+		for (; node != 0; node = node->parent)
+		{
+			for (cmpNode* sibling = node->next_sibling; sibling != 0; sibling = sibling->next_sibling)
+			{
+				if (cmpToken* token = FirstTokenInTree(sibling))
+					return token;
+			}
+		}
+
+		return 0;
+	}
+
+
+	cmpToken* FirstTokenFrom(cmpNode* node)
+	{
+		// Tokens placed at a node without any go before those that follow it
+		cmpToken* token = FirstTokenInTree(node);
+		return token != 0 ? token : FirstTokenAfterTree(node);
+	}
+}
+
+
+void ComputeProcessor::ReplaceTokens(cmpNode* node, cmpToken* first_token, cmpToken* last_token, TokenList& tokens)
+{
+	assert(node != 0);
+
+	// Ordinals check the range is within the node without walking its tokens
+	if (first_token == 0 || last_token == 0 || node->first_token == 0 ||
+		first_token->ordinal < node->first_token->ordinal || last_token->ordinal < first_token->ordinal ||
+		last_token->ordinal > node->last_token->ordinal)
+	{
+		tokens.DeleteAll();
+		throw cmpError_Create("%s(%d): Replaced tokens must be within the node that owns them", m_InputFilename.c_str(), first_token != 0 ? first_token->line : 0);
+	}
+
+	QueueTokenEdit(TokenEdit::Type_Replace, node, first_token, last_token, tokens);
+}
+
+
+void ComputeProcessor::DeleteTokens(cmpNode* node, cmpToken* first_token, cmpToken* last_token)
+{
+	TokenList no_tokens;
+	ReplaceTokens(node, first_token, last_token, no_tokens);
+}
+
+
+void ComputeProcessor::AppendTokens(cmpNode* node, TokenList& tokens)
+{
+	QueueTokenEdit(TokenEdit::Type_Append, node, 0, 0, tokens);
+}
+
+
+cmpNode* ComputeProcessor::InsertNodeBefore(cmpNode* node, TokenList& tokens)
+{
+	return QueueTokenEdit(TokenEdit::Type_InsertBefore, node, 0, 0, tokens);
+}
+
+
+cmpNode* ComputeProcessor::InsertNodeAfter(cmpNode* node, TokenList& tokens)
+{
+	return QueueTokenEdit(TokenEdit::Type_InsertAfter, node, 0, 0, tokens);
+}
+
+
+void ComputeProcessor::ApplyRewrites()
+{
+	for (size_t i = 0; i < m_TokenEdits.size(); i++)
+	{
+		TokenEdit& edit = m_TokenEdits[i];
+		switch (edit.type)
+		{
+			case TokenEdit::Type_Replace:
+				ReplaceTokens(edit);
+				break;
+
+			case TokenEdit::Type_Append:
+				if (edit.tokens.first == 0)
+					break;
+				if (edit.node->last_token != 0)
+				{
+					SpliceTokens(edit.node->last_token->next, edit.tokens);
+				}
+				else
+				{
+					SpliceTokens(FirstTokenFrom(edit.node), edit.tokens);
+					edit.node->first_token = edit.tokens.first;
+				}
+				edit.node->last_token = edit.tokens.last;
+				break;
+
+			case TokenEdit::Type_InsertBefore:
+				SpliceTokens(FirstTokenFrom(edit.node), edit.tokens);
+				cmpNode_AddBefore(edit.node, edit.new_node);
+				break;
+
+			case TokenEdit::Type_InsertAfter:
+				SpliceTokens(FirstTokenAfterTree(edit.node), edit.tokens);
+				cmpNode_AddAfter(edit.node, edit.new_node);
+				break;
+		}
+	}
+
+	m_TokenEdits.clear();
+	m_ReplacedRanges.clear();
+}
+
+
+cmpNode* ComputeProcessor::QueueTokenEdit(TokenEdit::Type type, cmpNode* node, cmpToken* first_token, cmpToken* last_token, TokenList& tokens)
+{
+	assert(node != 0);
+
+	TokenEdit edit;
+	edit.type = type;
+	edit.node = node;
+	edit.first_token = first_token;
+	edit.last_token = last_token;
+	edit.new_node = 0;
+
+	// Replaced ranges are cut out of the list when applied, so an edit inside one would work on deleted
+	// tokens. Ordinals check they don't overlap without walking the tokens.
+	if (type == TokenEdit::Type_Replace)
+	{
+		std::map<cmpU64, cmpU64>::iterator next = m_ReplacedRanges.lower_bound(first_token->ordinal);
+		bool overlaps = next != m_ReplacedRanges.end() && next->first <= last_token->ordinal;
+		if (next != m_ReplacedRanges.begin())
+		{
+			std::map<cmpU64, cmpU64>::iterator prev = next;
+			--prev;
+			overlaps |= prev->second >= first_token->ordinal;
+		}
+		if (overlaps)
+		{
+			tokens.DeleteAll();
+			throw cmpError_Create("%s(%d): Replaced tokens overlap those of another edit", m_InputFilename.c_str(), first_token->line);
+		}
+		m_ReplacedRanges.insert(next, std::make_pair(first_token->ordinal, last_token->ordinal));
+	}
+
+	// Inserted nodes are created now so that allocation failures are reported to the transform
+	if (type == TokenEdit::Type_InsertBefore || type == TokenEdit::Type_InsertAfter)
+	{
+		cmpError error = cmpNode_CreateEmpty(&edit.new_node);
+		if (!cmpError_OK(&error))
+			throw error;
+		edit.new_node->type = cmpNode_UserTokens;
+		edit.new_node->first_token = tokens.first;
+		edit.new_node->last_token = tokens.last;
+	}
+
+	// Take ownership of the tokens
+	edit.tokens = tokens;
+	tokens.first = 0;
+	tokens.last = 0;
+
+	m_TokenEdits.push_back(edit);
+	return edit.new_node;
+}
+
+
+void ComputeProcessor::SpliceTokens(cmpToken* next_token, TokenList& tokens)
+{
+	if (tokens.first == 0)
+		return;
+
+	cmpToken* prev_token = next_token != 0 ? next_token->prev : m_Tokens.last;
+	tokens.first->prev = prev_token;
+	tokens.last->next = next_token;
+
+	if (prev_token != 0)
+		prev_token->next = tokens.first;
+	else
+		m_Tokens.first = tokens.first;
+	if (next_token != 0)
+		next_token->prev = tokens.last;
+	else
+		m_Tokens.last = tokens.last;
+
+	// Pack the new tokens at the start of the ordinal gap they're placed in, leaving the rest of it for
+	// the next insertion at the same place, such as repeated appends to a node
+	cmpU64 nb_tokens = 0;
+	for (cmpToken* token = tokens.first; token != next_token; token = token->next)
+		nb_tokens++;
+	cmpU64 ordinal = prev_token != 0 ? prev_token->ordinal : 0;
+	cmpU64 step = CMP_TOKEN_ORDINAL_GAP;
+	if (next_token != 0)
+		step = std::min(INSERTED_TOKEN_ORDINAL_GAP, (next_token->ordinal - ordinal) / (nb_tokens + 1));
+	if (step == 0)
+	{
+		// Only once the gap has been used up does the whole list need numbering again
+		RenumberTokens();
+		return;
+	}
+	for (cmpToken* token = tokens.first; token != next_token; token = token->next)
+	{
+		ordinal += step;
+		token->ordinal = ordinal;
+	}
+}
+
+
+void ComputeProcessor::RenumberTokens()
+{
+	cmpU64 ordinal = 0;
+	for (cmpToken* token = m_Tokens.first; token != 0; token = token->next)
+	{
+		ordinal += CMP_TOKEN_ORDINAL_GAP;
+		token->ordinal = ordinal;
+	}
+}
+
+
+void ComputeProcessor::ReplaceTokens(const TokenEdit& edit)
+{
+	cmpNode* node = edit.node;
+	cmpToken* prev_token = edit.first_token->prev;
+	cmpToken* next_token = edit.last_token->next;
+	bool replaces_first = node->first_token == edit.first_token;
+	bool replaces_last = node->last_token == edit.last_token;
+
+	// Cut the old tokens out and delete them
+	if (prev_token != 0)
+		prev_token->next = next_token;
+	else
+		m_Tokens.first = next_token;
+	if (next_token != 0)
+		next_token->prev = prev_token;
+	else
+		m_Tokens.last = prev_token;
+	edit.last_token->next = 0;
+	TokenList old_tokens(edit.first_token, edit.last_token);
+	old_tokens.DeleteAll();
+
+	TokenList tokens = edit.tokens;
+	SpliceTokens(next_token, tokens);
+
+	// Keep the node's range on the tokens it still owns, leaving it empty if they've all gone
+	if (tokens.first != 0)
+	{
+		if (replaces_first)
+			node->first_token = tokens.first;
+		if (replaces_last)
+			node->last_token = tokens.last;
+	}
+	else if (replaces_first && replaces_last)
+	{
+		node->first_token = 0;
+		node->last_token = 0;
+	}
+	else if (replaces_first)
+	{
+		node->first_token = next_token;
+	}
+	else if (replaces_last)
+	{
+		node->last_token = prev_token;
+	}
+}
+
+
 TokenIterator::TokenIterator(cmpNode& node)
 	: first_token(node.first_token)
 	, last_token(node.last_token ? node.last_token->next : 0)
@@ -5,6 +5,8 @@
 
 #include "Base.h"
 #include "../../lib/ComputeParser.h"
+#include <cstring>
+#include <map>
 #include <vector>
 
 
@@ -46,6 +48,24 @@ struct TokenList
 };
 
 
+//
+// Span of the input file that's already known to hold a single token of the given type
+//
+struct TokenSpan
+{
+	TokenSpan(enum cmpTokenType type, cmpU32 start, cmpU32 length)
+		: type(type)
+		, start(start)
+		, length(length)
+	{
+	}
+
+	enum cmpTokenType type;
+	cmpU32 start;
+	cmpU32 length;
+};
+
+
 enum ComputeTarget
 {
 	ComputeTarget_None,
@@ -54,11 +74,29 @@ enum ComputeTarget
 };
 
 
+// Conversion between targets and the names used to select them on the command-line
+ComputeTarget ComputeTargetFromName(std::string name);
+const char* ComputeTargetName(ComputeTarget target);
+
+// Size of CUDA's long and ulong, which follows the host compiler rather than the device. It's given by
+// -cuda_long_size, defaulting to the long of the platform cbpp is built for. Returns false if the option
+// is given as anything other than 4 or 8.
+bool GetCudaLongSize(const Arguments& args, cmpU32& size);
+
+
 
 class ComputeProcessor
 {
 public:
-	ComputeProcessor(const Arguments& arguments, const std::string& input_filename, const std::vector<char>& file_data, ComputeTarget target);
+	// Token spans classified by the preprocessor are taken as they are when parsing, leaving the lexer to
+	// read only the text between them. They must be in file order and can be empty.
+	ComputeProcessor(const Arguments& arguments, const std::string& input_filename, const std::vector<char>& file_data, const std::vector<TokenSpan>& token_spans, ComputeTarget target);
+
+	// Shares the parse of another processor whose preprocessed input is identical. ParseFile duplicates
+	// the source tokens and nodes, which continue to reference the source file data; the source must
+	// outlive this processor and must not have had its transforms applied before ParseFile is called.
+	ComputeProcessor(const ComputeProcessor& source, ComputeTarget target);
+
 	~ComputeProcessor();
 
 	bool ParseFile();
@@ -73,7 +111,81 @@ public:
 	ComputeTarget Target() const { return m_Target; }
 	cmpNode* RootNode() const { return m_RootNode; }
 
+	// Retrieves the value of a comma-separated argument that is paired by position with the -target list
+	std::string TargetProperty(const std::string& arg) const;
+
+	// Size of long and ulong on the target
+	cmpU32 LongSize() const;
+
+	// Whether the token was read from the input file, rather than made by a transform
+	bool IsInputToken(const cmpToken& token) const;
+
+	//
+	// Token rewriting. Edits are queued and applied together after the transform making them returns,
+	// keeping the tokens and nodes it found valid while it works. Token lists passed in are taken over
+	// and freed along with the parsed tokens, as are any tokens that edits remove. Each node owns a
+	// contiguous range of tokens that edits keep its first/last tokens in step with.
+	//
+	// Applying an edit splices its tokens in without walking the token list. The exception is placing
+	// tokens at a node with none of its own or after a node, which first has to find the next token by
+	// searching the trees that follow, costing as much as the nodes it passes over.
+	//
+
+	// The range replaced or deleted must be within the node's own tokens and can't overlap that of any
+	// other edit queued with it. Breaking either rule throws a cmpError, still freeing the tokens passed in.
+	void ReplaceTokens(cmpNode* node, cmpToken* first_token, cmpToken* last_token, TokenList& tokens);
+	void DeleteTokens(cmpNode* node, cmpToken* first_token, cmpToken* last_token);
+
+	// Adds tokens after the node's own tokens, before any of its children
+	void AppendTokens(cmpNode* node, TokenList& tokens);
+
+	// Adds a user node that owns the tokens as a sibling of the node, returning it before it's linked
+	cmpNode* InsertNodeBefore(cmpNode* node, TokenList& tokens);
+	cmpNode* InsertNodeAfter(cmpNode* node, TokenList& tokens);
+
+	// Applies all queued edits in the order they were made, for transforms that need to see their edits
+	void ApplyRewrites();
+
 private:
+	// Non-copyable
+	ComputeProcessor(const ComputeProcessor&);
+	ComputeProcessor& operator = (const ComputeProcessor&);
+
+	bool CloneParse();
+
+	struct TokenEdit
+	{
+		enum Type
+		{
+			Type_Replace,
+			Type_Append,
+			Type_InsertBefore,
+			Type_InsertAfter,
+		};
+
+		Type type;
+
+		// Node whose tokens are edited or that a new node is placed next to
+		cmpNode* node;
+
+		// Range of tokens being replaced
+		cmpToken* first_token;
+		cmpToken* last_token;
+
+		// Tokens being added, owned by the new node when inserting
+		TokenList tokens;
+		cmpNode* new_node;
+	};
+
+	cmpNode* QueueTokenEdit(TokenEdit::Type type, cmpNode* node, cmpToken* first_token, cmpToken* last_token, TokenList& tokens);
+
+	// Links tokens into the token list before the given token, or at the end when it's null, giving them
+	// ordinals between those of their neighbours
+	void SpliceTokens(cmpToken* next_token, TokenList& tokens);
+	void RenumberTokens();
+
+	void ReplaceTokens(const TokenEdit& edit);
+
 	// Copy of command-line arguments
 	::Arguments m_Arguments;
 
@@ -83,11 +195,17 @@ private:
 	// Copy of the input file data so that its lifetime can be managed here
 	std::vector<char> m_FileData;
 
+	// Tokens in the input file that don't need lexing
+	std::vector<TokenSpan> m_TokenSpans;
+
 	std::string m_ExecutableDirectory;
 
 	// Which target compute language is being rewritten
 	ComputeTarget m_Target;
 
+	// Processor whose parse is shared, if any
+	const ComputeProcessor* m_Source;
+
 	// Parser runtime
 	cmpLexerCursor* m_LexerCursor;
 	cmpParserCursor* m_ParserCursor;
@@ -100,6 +218,12 @@ private:
 
 	// List of active transforms
 	std::vector<ITransform*> m_Transforms;
+
+	// Edits waiting to be applied
+	std::vector<TokenEdit> m_TokenEdits;
+
+	// Ordinals of the first/last tokens of each range queued edits replace, indexed by the first
+	std::map<cmpU64, cmpU64> m_ReplacedRanges;
 };
 
 
@@ -120,7 +244,7 @@ struct TokenIterator
 	cmpToken* SeekToken(const MATCH& match)
 	{
 		cmpToken* cur_token = token;
-		while (cur_token < last_token)
+		while (cur_token != 0 && cur_token != last_token)
 		{
 			if (match(*cur_token))
 			{
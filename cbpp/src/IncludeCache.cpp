@@ -0,0 +1,81 @@
+
+#include "IncludeCache.h"
+
+
+namespace
+{
+	// Directories modified this recently may change again without their time changing
+	const time_t UNSETTLED_DIRECTORY_SECONDS = 2;
+
+
+	cmpU64 GetModifiedTime(const FileInfo& info)
+	{
+		return (cmpU64)info.modified_time * 1000000000 + info.modified_time_ns;
+	}
+
+
+	cmpU64 GetDirectoryTime(const std::string& path, IncludeCache::DirectoryTimes& directory_times)
+	{
+		// Directories that don't exist get a time of zero
+		std::string directory = GetPathDirectory(path);
+		IncludeCache::DirectoryTimes::const_iterator i = directory_times.find(directory);
+		if (i != directory_times.end())
+			return i->second;
+
+		FileInfo info;
+		cmpU64 time = GetFileInfo(directory, info) ? GetModifiedTime(info) : 0;
+		directory_times[directory] = time;
+		return time;
+	}
+
+
+	bool IsDirectorySettled(cmpU64 directory_time)
+	{
+		time_t now = time(0);
+		return (time_t)(directory_time / 1000000000) + UNSETTLED_DIRECTORY_SECONDS <= now;
+	}
+}
+
+
+IncludeCache::FileData IncludeCache::Load(const std::string& path, DirectoryTimes& directory_times)
+{
+	// Answer for missing paths without touching the disk until their directory changes
+	cmpU64 directory_time = GetDirectoryTime(path, directory_times);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		std::map<std::string, cmpU64>::const_iterator i = m_MissingPaths.find(path);
+		if (i != m_MissingPaths.end() && i->second == directory_time)
+			return FileData();
+	}
+
+	FileInfo info;
+	if (!GetFileInfo(path, info))
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (IsDirectorySettled(directory_time))
+			m_MissingPaths[path] = directory_time;
+		else
+			m_MissingPaths.erase(path);
+		return FileData();
+	}
+
+	// Reuse the cached contents if the file hasn't changed since it was read
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_MissingPaths.erase(path);
+		std::map<std::string, Entry>::const_iterator i = m_Entries.find(path);
+		if (i != m_Entries.end() && i->second.info.size == info.size && GetModifiedTime(i->second.info) == GetModifiedTime(info))
+			return i->second.data;
+	}
+
+	// Read without holding the lock so that other files can be served meanwhile
+	std::shared_ptr<std::vector<char> > data(new std::vector<char>);
+	if (!LoadFileData(path.c_str(), *data))
+		return FileData();
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	Entry& entry = m_Entries[path];
+	entry.info = info;
+	entry.data = data;
+	return data;
+}
@@ -0,0 +1,56 @@
+
+#ifndef INCLUDED_INCLUDE_CACHE_H
+#define INCLUDED_INCLUDE_CACHE_H
+
+
+#include "Base.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+
+//
+// In-memory copies of include files, shared between preprocessing runs so that the same headers
+// aren't read from disk again for every kernel in batch and server use.
+//
+// Entries are keyed by path and only reused while the size and modification time of the file on disk
+// still match. Contents are handed out as shared pointers so that a run can keep using a file while
+// another run replaces its entry. All methods are safe to call from multiple threads.
+//
+// Paths that couldn't be read are remembered too, as searching include directories tries many
+// paths that don't exist. These are trusted until the modification time of their directory
+// changes, which happens whenever files are added to it. Each run checks a directory at most once,
+// recording what it saw in the DirectoryTimes it passes in.
+//
+// Times are compared to the nanosecond where the file system records them. As a file system's
+// clock can still be coarser than that, a miss is only remembered once its directory has gone
+// unchanged for a few seconds; a file added straight after could otherwise leave the time as it was.
+//
+class IncludeCache
+{
+public:
+	typedef std::shared_ptr<const std::vector<char> > FileData;
+
+	// Modification times in nanoseconds, zero for directories that don't exist
+	typedef std::map<std::string, cmpU64> DirectoryTimes;
+
+	// Returns NULL if the file can't be read
+	FileData Load(const std::string& path, DirectoryTimes& directory_times);
+
+private:
+	struct Entry
+	{
+		FileInfo info;
+		FileData data;
+	};
+
+	std::mutex m_Mutex;
+	std::map<std::string, Entry> m_Entries;
+
+	// Modification time of the directory when each missing path was looked for
+	std::map<std::string, cmpU64> m_MissingPaths;
+};
+
+
+#endif
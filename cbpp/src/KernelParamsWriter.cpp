@@ -0,0 +1,357 @@
+
+#include "KernelParamsWriter.h"
+#include "../inc/cbpp/KernelParams.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+
+namespace
+{
+	size_t Align(size_t offset, size_t alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+
+	// Written a byte at a time so that the file is the same on any host
+	void PutU32(std::vector<char>& data, size_t offset, cmpU32 value)
+	{
+		for (int i = 0; i < 4; i++)
+			data[offset + i] = (char)(value >> (i * 8));
+	}
+
+
+	//
+	// Builds the string table, placing each string at a 4-byte aligned offset from the file start
+	//
+	struct StringTable
+	{
+		StringTable(size_t offset)
+			: offset(offset)
+		{
+		}
+
+		cmpU32 Add(const std::string& str)
+		{
+			size_t str_offset = offset + data.size();
+			data.insert(data.end(), str.begin(), str.end());
+			data.resize(Align(data.size() + 1, 4), 0);
+			return (cmpU32)str_offset;
+		}
+
+		size_t offset;
+		std::vector<char> data;
+	};
+
+
+	// Replaces anything that can't be part of a C++ identifier
+	std::string MakeIdentifier(const std::string& str)
+	{
+		std::string identifier = str;
+		for (size_t i = 0; i < identifier.length(); i++)
+		{
+			if (!isalnum((unsigned char)identifier[i]))
+				identifier[i] = '_';
+		}
+		if (identifier.empty() || isdigit((unsigned char)identifier[0]))
+			identifier = "_" + identifier;
+		return identifier;
+	}
+
+
+	std::string QuoteChar(char c)
+	{
+		if (c == 0)
+			return "0";
+		return std::string("'") + c + "'";
+	}
+
+
+	std::string FormatU32(cmpU32 value)
+	{
+		char text[16];
+		sprintf(text, "%u", value);
+		return text;
+	}
+
+
+	std::string LayoutValue(cmpU32 value)
+	{
+		return value == LAYOUT_UNKNOWN ? "unknown" : FormatU32(value);
+	}
+
+
+	cmpU32 TargetID(ComputeTarget target)
+	{
+		switch (target)
+		{
+			case ComputeTarget_CUDA: return CBPP_KERNEL_PARAMS_TARGET_CUDA;
+			case ComputeTarget_OpenCL: return CBPP_KERNEL_PARAMS_TARGET_OPENCL;
+			default: return 0;
+		}
+	}
+
+
+	bool KernelNameLess(const KernelInfo& a, const KernelInfo& b)
+	{
+		return a.name < b.name;
+	}
+}
+
+
+std::string GetHeaderInputName(const std::string& input_filename)
+{
+	std::string filename = input_filename.substr(GetPathDirectory(input_filename).length());
+	if (filename.length() && (filename[0] == '/' || filename[0] == '\\'))
+		filename = filename.substr(1);
+	return filename;
+}
+
+
+std::string GetHeaderNamespace(const std::string& input_filename, const char* target_name)
+{
+	std::string filename = GetHeaderInputName(input_filename);
+	std::string stem = filename.substr(0, filename.rfind('.'));
+	return MakeIdentifier(stem + "_" + target_name);
+}
+
+
+KernelParamsWriter::KernelParamsWriter(ComputeTarget target)
+	: m_Target(target)
+{
+}
+
+
+void KernelParamsWriter::AddKernel(const KernelInfo& kernel)
+{
+	m_Kernels.push_back(kernel);
+}
+
+
+void KernelParamsWriter::Write(std::vector<char>& data) const
+{
+	std::vector<KernelInfo> functions = SortedKernels();
+
+	size_t nb_params = 0;
+	for (size_t i = 0; i < functions.size(); i++)
+		nb_params += functions[i].params.size();
+
+	// Keep the hash table at most half full
+	cmpU32 nb_hash_slots = 1;
+	while (nb_hash_slots < functions.size() * 2)
+		nb_hash_slots *= 2;
+
+	// Lay out the tables one after the other
+	size_t functions_offset = Align(sizeof(cbppKernelParamsHeader), 8);
+	size_t params_offset = Align(functions_offset + functions.size() * sizeof(cbppKernelFunction), 8);
+	size_t hash_slots_offset = Align(params_offset + nb_params * sizeof(cbppKernelParam), 8);
+	size_t strings_offset = Align(hash_slots_offset + nb_hash_slots * sizeof(cmpU32), 8);
+
+	data.clear();
+	data.resize(strings_offset, 0);
+	StringTable strings(strings_offset);
+
+	// Function and parameter tables
+	std::vector<cmpU32> hash_slots(nb_hash_slots, 0);
+	size_t param_index = 0;
+	for (size_t i = 0; i < functions.size(); i++)
+	{
+		const KernelInfo& function = functions[i];
+		cmpU32 name_hash = cbppKernelParams_Hash(function.name.c_str());
+
+		size_t offset = functions_offset + i * sizeof(cbppKernelFunction);
+		PutU32(data, offset + offsetof(cbppKernelFunction, name_offset), strings.Add(function.name));
+		PutU32(data, offset + offsetof(cbppKernelFunction, name_hash), name_hash);
+		PutU32(data, offset + offsetof(cbppKernelFunction, first_param), (cmpU32)param_index);
+		PutU32(data, offset + offsetof(cbppKernelFunction, nb_params), (cmpU32)function.params.size());
+		PutU32(data, offset + offsetof(cbppKernelFunction, nb_args), function.nb_args);
+		PutU32(data, offset + offsetof(cbppKernelFunction, args_size), function.args_size);
+		PutU32(data, offset + offsetof(cbppKernelFunction, args_alignment), function.args_alignment);
+
+		for (size_t j = 0; j < function.params.size(); j++, param_index++)
+		{
+			const KernelParam& param = function.params[j];
+			offset = params_offset + param_index * sizeof(cbppKernelParam);
+			PutU32(data, offset + offsetof(cbppKernelParam, name_offset), strings.Add(param.name));
+			PutU32(data, offset + offsetof(cbppKernelParam, type_offset), strings.Add(param.type));
+			if (!param.global_name.empty())
+				PutU32(data, offset + offsetof(cbppKernelParam, global_name_offset), strings.Add(param.global_name));
+			PutU32(data, offset + offsetof(cbppKernelParam, size), param.size);
+			PutU32(data, offset + offsetof(cbppKernelParam, alignment), param.alignment);
+			PutU32(data, offset + offsetof(cbppKernelParam, offset), param.offset);
+			PutU32(data, offset + offsetof(cbppKernelParam, arg_index), param.arg_index);
+			data[offset + offsetof(cbppKernelParam, kind)] = param.kind;
+			data[offset + offsetof(cbppKernelParam, address_space)] = param.address_space;
+			data[offset + offsetof(cbppKernelParam, dimensions)] = (char)param.dimensions;
+			data[offset + offsetof(cbppKernelParam, read_type)] = param.read_type;
+		}
+
+		// Linear probe for a free slot
+		cmpU32 slot = name_hash & (nb_hash_slots - 1);
+		while (hash_slots[slot] != 0)
+			slot = (slot + 1) & (nb_hash_slots - 1);
+		hash_slots[slot] = (cmpU32)i + 1;
+	}
+
+	for (cmpU32 i = 0; i < nb_hash_slots; i++)
+		PutU32(data, hash_slots_offset + i * sizeof(cmpU32), hash_slots[i]);
+
+	data.insert(data.end(), strings.data.begin(), strings.data.end());
+
+	// Header
+	memcpy(data.data(), CBPP_KERNEL_PARAMS_MAGIC, 8);
+	PutU32(data, offsetof(cbppKernelParamsHeader, version), CBPP_KERNEL_PARAMS_VERSION);
+	PutU32(data, offsetof(cbppKernelParamsHeader, file_size), (cmpU32)data.size());
+	PutU32(data, offsetof(cbppKernelParamsHeader, target), TargetID(m_Target));
+	PutU32(data, offsetof(cbppKernelParamsHeader, nb_functions), (cmpU32)functions.size());
+	PutU32(data, offsetof(cbppKernelParamsHeader, functions_offset), (cmpU32)functions_offset);
+	PutU32(data, offsetof(cbppKernelParamsHeader, nb_params), (cmpU32)nb_params);
+	PutU32(data, offsetof(cbppKernelParamsHeader, params_offset), (cmpU32)params_offset);
+	PutU32(data, offsetof(cbppKernelParamsHeader, nb_hash_slots), nb_hash_slots);
+	PutU32(data, offsetof(cbppKernelParamsHeader, hash_slots_offset), (cmpU32)hash_slots_offset);
+	PutU32(data, offsetof(cbppKernelParamsHeader, strings_size), (cmpU32)strings.data.size());
+	PutU32(data, offsetof(cbppKernelParamsHeader, strings_offset), (cmpU32)strings_offset);
+}
+
+
+void KernelParamsWriter::WriteHeader(std::vector<char>& data, const std::string& input_filename, const char* target_name) const
+{
+	std::vector<KernelInfo> functions = SortedKernels();
+
+	std::string filename = GetHeaderInputName(input_filename);
+	std::string namespace_name = GetHeaderNamespace(input_filename, target_name);
+	std::string guard = "INCLUDED_CBPP_" + namespace_name + "_H";
+	for (size_t i = 0; i < guard.length(); i++)
+		guard[i] = toupper((unsigned char)guard[i]);
+
+	std::string text;
+	text += "\n";
+	text += "//\n";
+	text += "// Parameters of each kernel in " + filename + ", generated by cbpp for " + target_name + "\n";
+	text += "//\n";
+	text += "\n";
+	text += "#ifndef " + guard + "\n";
+	text += "#define " + guard + "\n";
+	text += "\n\n";
+	text += "#include <cstddef>\n";
+	text += "\n\n";
+	text += "namespace cbpp {\n";
+	text += "namespace " + namespace_name + "\n";
+	text += "{\n";
+	text += "\t// Size, alignment and offset of parameters with a layout cbpp doesn't know\n";
+	text += "\tconstexpr unsigned int unknown = 0xFFFFFFFF;\n";
+	text += "\n";
+	text += "\t// Argument index of parameters that aren't passed as arguments, such as CUDA textures\n";
+	text += "\tconstexpr unsigned int no_arg = 0xFFFFFFFF;\n";
+	text += "\n";
+	text += "\tstruct Param\n";
+	text += "\t{\n";
+	text += "\t\tconst char* name;\n";
+	text += "\n";
+	text += "\t\t// Type as written in the source, without its address space\n";
+	text += "\t\tconst char* type;\n";
+	text += "\n";
+	text += "\t\t// Global variable a CUDA texture or surface must be bound to, nullptr if there isn't one\n";
+	text += "\t\tconst char* global_name;\n";
+	text += "\n";
+	text += "\t\t// Layout within the block of arguments, with a zero size for parameters not passed as arguments\n";
+	text += "\t\tunsigned int size;\n";
+	text += "\t\tunsigned int alignment;\n";
+	text += "\t\tunsigned int offset;\n";
+	text += "\n";
+	text += "\t\t// Index of the kernel argument the parameter is passed as, for clSetKernelArg on OpenCL\n";
+	text += "\t\tunsigned int arg_index;\n";
+	text += "\n";
+	text += "\t\t// 'v' for values, 'p' for pointers, 't' for textures and 's' for surfaces\n";
+	text += "\t\tchar kind;\n";
+	text += "\n";
+	text += "\t\t// 'g' for cmp_global, 'c' for cmp_constant and zero for neither\n";
+	text += "\t\tchar address_space;\n";
+	text += "\n";
+	text += "\t\tunsigned int dimensions;\n";
+	text += "\n";
+	text += "\t\t// 'u' for element reads, 'n' for normalised float reads and zero for everything but textures\n";
+	text += "\t\tchar read_type;\n";
+	text += "\t};\n";
+	text += "\n";
+	text += "\tstruct Kernel\n";
+	text += "\t{\n";
+	text += "\t\tconst char* name;\n";
+	text += "\t\tconst Param* params;\n";
+	text += "\t\tstd::size_t nb_params;\n";
+	text += "\t\tunsigned int nb_args;\n";
+	text += "\n";
+	text += "\t\t// Size and alignment of the block of all arguments\n";
+	text += "\t\tunsigned int args_size;\n";
+	text += "\t\tunsigned int args_alignment;\n";
+	text += "\t};\n";
+
+	// Parameters of each kernel, with a placeholder for those with none as arrays can't be empty
+	char line[64];
+	for (size_t i = 0; i < functions.size(); i++)
+	{
+		const KernelInfo& function = functions[i];
+		text += "\n";
+		text += "\tconstexpr Param " + function.name + "_params[] =\n";
+		text += "\t{\n";
+		for (size_t j = 0; j < function.params.size(); j++)
+		{
+			const KernelParam& param = function.params[j];
+			std::string global_name = param.global_name.empty() ? "nullptr" : "\"" + param.global_name + "\"";
+			text += "\t\t{ \"" + param.name + "\", \"" + param.type + "\", " + global_name + ", ";
+			text += LayoutValue(param.size) + ", " + LayoutValue(param.alignment) + ", " + LayoutValue(param.offset) + ", ";
+			text += (param.arg_index == KERNEL_NO_ARG ? std::string("no_arg") : FormatU32(param.arg_index)) + ", ";
+			sprintf(line, ", %u, ", param.dimensions);
+			text += QuoteChar(param.kind) + ", " + QuoteChar(param.address_space) + line + QuoteChar(param.read_type) + " },\n";
+		}
+		if (function.params.empty())
+			text += "\t\t{ nullptr, nullptr, nullptr, 0, 0, 0, no_arg, 0, 0, 0, 0 },\n";
+		text += "\t};\n";
+	}
+
+	text += "\n";
+	text += "\tconstexpr Kernel kernels[] =\n";
+	text += "\t{\n";
+	for (size_t i = 0; i < functions.size(); i++)
+	{
+		const KernelInfo& function = functions[i];
+		text += "\t\t{ \"" + function.name + "\", " + function.name + "_params, " + FormatU32((cmpU32)function.params.size()) + ", " + FormatU32(function.nb_args) + ", ";
+		text += LayoutValue(function.args_size) + ", " + LayoutValue(function.args_alignment) + " },\n";
+	}
+	if (functions.empty())
+		text += "\t\t{ nullptr, nullptr, 0, 0, 0, 0 },\n";
+	text += "\t};\n";
+	text += "\n";
+	sprintf(line, "%u", (cmpU32)functions.size());
+	text += "\tconstexpr std::size_t nb_kernels = " + std::string(line) + ";\n";
+	text += "\n";
+	text += "\tconstexpr bool NameEquals(const char* a, const char* b)\n";
+	text += "\t{\n";
+	text += "\t\treturn *a == *b && (*a == 0 || NameEquals(a + 1, b + 1));\n";
+	text += "\t}\n";
+	text += "\n";
+	text += "\t// Returns nullptr if there is no kernel definition with the name, resolving at compile-time for constant names\n";
+	text += "\tconstexpr const Kernel* FindKernel(const char* name, std::size_t index = 0)\n";
+	text += "\t{\n";
+	text += "\t\treturn index == nb_kernels ? nullptr : NameEquals(kernels[index].name, name) ? &kernels[index] : FindKernel(name, index + 1);\n";
+	text += "\t}\n";
+	text += "}\n";
+	text += "}\n";
+	text += "\n";
+	text += "\n";
+	text += "#endif\n";
+
+	data.assign(text.begin(), text.end());
+}
+
+
+std::vector<KernelInfo> KernelParamsWriter::SortedKernels() const
+{
+	std::vector<KernelInfo> kernels = m_Kernels;
+	std::sort(kernels.begin(), kernels.end(), KernelNameLess);
+	return kernels;
+}
@@ -0,0 +1,43 @@
+
+#ifndef INCLUDED_KERNEL_PARAMS_WRITER_H
+#define INCLUDED_KERNEL_PARAMS_WRITER_H
+
+
+#include "KernelReflection.h"
+
+
+// Input filename without its directory, as named in the comments of generated headers
+std::string GetHeaderInputName(const std::string& input_filename);
+
+// Generated headers are placed in namespace cbpp::<input file stem>_<target> so that headers for several
+// inputs and targets can be used together
+std::string GetHeaderNamespace(const std::string& input_filename, const char* target_name);
+
+
+//
+// Builds the kernel parameter file written with -output_bin, in the layout described by
+// inc/cbpp/KernelParams.h, and the C++ header of the same tables written with -output_header.
+// Kernels are sorted by name when written.
+//
+class KernelParamsWriter
+{
+public:
+	KernelParamsWriter(ComputeTarget target);
+
+	void AddKernel(const KernelInfo& kernel);
+
+	void Write(std::vector<char>& data) const;
+
+	// Places the tables in the namespace given by GetHeaderNamespace as constexpr arrays
+	void WriteHeader(std::vector<char>& data, const std::string& input_filename, const char* target_name) const;
+
+private:
+	std::vector<KernelInfo> SortedKernels() const;
+
+	ComputeTarget m_Target;
+
+	std::vector<KernelInfo> m_Kernels;
+};
+
+
+#endif
@@ -0,0 +1,246 @@
+
+#include "KernelReflection.h"
+
+#include <cassert>
+#include <cstring>
+
+
+namespace
+{
+	HashString KEYWORD_cmp_kernel_fn("cmp_kernel_fn");
+	HashString KEYWORD_cmp_global("cmp_global");
+	HashString KEYWORD_cmp_constant("cmp_constant");
+
+
+	void ReflectParam(const std::vector<cmpToken*>& tokens, const ComputeProcessor& processor, const StructLayouts& structs, KernelParam& param)
+	{
+		// Arrays are passed as pointers so look for the name before any bounds
+		size_t name_index = tokens.size();
+		size_t bounds_index = tokens.size();
+		for (size_t i = 0; i < tokens.size(); i++)
+		{
+			if (tokens[i]->type == cmpToken_LSqBracket)
+			{
+				bounds_index = i;
+				break;
+			}
+			if (tokens[i]->type == cmpToken_Symbol)
+				name_index = i;
+		}
+
+		// Type tokens are everything before the name, leaving out the address space
+		std::vector<cmpToken*> type_tokens;
+		bool is_array = bounds_index < tokens.size();
+		bool is_pointer = is_array;
+		for (size_t i = 0; i < name_index && i < tokens.size(); i++)
+		{
+			cmpToken* token = tokens[i];
+			if (token->hash == KEYWORD_cmp_global.hash)
+				param.address_space = 'g';
+			else if (token->hash == KEYWORD_cmp_constant.hash)
+				param.address_space = 'c';
+			else
+			{
+				if (token->type == cmpToken_Asterisk)
+					is_pointer = true;
+				type_tokens.push_back(token);
+			}
+		}
+		if (name_index < tokens.size())
+			param.name = std::string(tokens[name_index]->start, tokens[name_index]->length);
+
+		param.type = GetTypeText(type_tokens);
+
+		// Arrays decay to a pointer to their first element, keeping the bounds of any further dimensions
+		if (is_array)
+		{
+			size_t end = bounds_index;
+			while (end < tokens.size() && tokens[end]->type != cmpToken_RSqBracket)
+				end++;
+			std::vector<cmpToken*> inner_bounds;
+			if (end < tokens.size())
+				inner_bounds.assign(tokens.begin() + end + 1, tokens.end());
+			param.type += inner_bounds.empty() ? "*" : "(*)" + GetTypeText(inner_bounds);
+		}
+
+		// Textures and surfaces are only passed as arguments on OpenCL, where they're image handles
+		const char* type = param.type.c_str();
+		if (!strncmp(type, "Texture", 7) && param.type.length() > 9 && type[8] == 'D')
+		{
+			param.kind = 't';
+			param.dimensions = type[7] - '0';
+			param.read_type = type[9];
+		}
+		else if (!strncmp(type, "Surface", 7) && param.type.length() > 8 && type[8] == 'D')
+		{
+			param.kind = 's';
+			param.dimensions = type[7] - '0';
+		}
+		if (param.kind == 't' || param.kind == 's')
+		{
+			param.size = processor.Target() == ComputeTarget_OpenCL ? 8 : 0;
+			param.alignment = processor.Target() == ComputeTarget_OpenCL ? 8 : 1;
+			return;
+		}
+
+		// Device pointers are 64-bit on all supported targets
+		if (is_pointer)
+		{
+			param.kind = 'p';
+			param.size = 8;
+			param.alignment = 8;
+			return;
+		}
+
+		param.kind = 'v';
+		TypeLayout layout;
+		GetTypeLayout(type_tokens, processor, structs, layout);
+		param.size = layout.size;
+		param.alignment = layout.alignment;
+	}
+
+
+	void ReflectParams(cmpNode* params_node, const ComputeProcessor& processor, const StructLayouts& structs, KernelInfo& kernel)
+	{
+		// Split the tokens between the brackets at each top-level comma
+		std::vector<cmpToken*> tokens;
+		int depth = 0;
+		for (cmpToken* token = params_node->first_token->next; token != 0; token = token->next)
+		{
+			if (token->type == cmpToken_LBracket || token->type == cmpToken_LAngle || token->type == cmpToken_LSqBracket)
+				depth++;
+			bool closing = token->type == cmpToken_RBracket || token->type == cmpToken_RAngle || token->type == cmpToken_RSqBracket;
+			bool end = closing && depth == 0;
+			if (closing && depth > 0)
+				depth--;
+
+			if (end || (token->type == cmpToken_Comma && depth == 0))
+			{
+				// Parameter lists with no parameters or a lone "void" have nothing to record
+				bool is_void = tokens.size() == 1 && tokens[0]->length == 4 && !strncmp(tokens[0]->start, "void", 4);
+				if (!tokens.empty() && !is_void)
+				{
+					KernelParam param;
+					ReflectParam(tokens, processor, structs, param);
+					kernel.params.push_back(param);
+				}
+				tokens.clear();
+			}
+			else if (token->type != cmpToken_Whitespace && token->type != cmpToken_EOL && token->type != cmpToken_Comment)
+				tokens.push_back(token);
+
+			if (end || token == params_node->last_token)
+				break;
+		}
+
+		// Number the parameters that are passed as arguments, which are all those with a size
+		for (size_t i = 0; i < kernel.params.size(); i++)
+		{
+			KernelParam& param = kernel.params[i];
+			if (param.size != 0)
+				param.arg_index = kernel.nb_args++;
+		}
+
+		// Pack the arguments, giving up on offsets after the first one with an unknown layout
+		cmpU32 offset = 0;
+		for (size_t i = 0; i < kernel.params.size(); i++)
+		{
+			KernelParam& param = kernel.params[i];
+			if (offset == LAYOUT_UNKNOWN || param.size == LAYOUT_UNKNOWN)
+			{
+				offset = LAYOUT_UNKNOWN;
+				param.offset = LAYOUT_UNKNOWN;
+				continue;
+			}
+
+			offset = (offset + param.alignment - 1) & ~(param.alignment - 1);
+			param.offset = offset;
+			offset += param.size;
+			if (param.alignment > kernel.args_alignment)
+				kernel.args_alignment = param.alignment;
+		}
+
+		if (offset == LAYOUT_UNKNOWN)
+		{
+			kernel.args_size = LAYOUT_UNKNOWN;
+			kernel.args_alignment = LAYOUT_UNKNOWN;
+		}
+		else
+			kernel.args_size = (offset + kernel.args_alignment - 1) & ~(kernel.args_alignment - 1);
+	}
+
+
+	class FindKernels : public INodeVisitor
+	{
+	public:
+		FindKernels(const StructLayouts& structs, std::vector<KernelInfo>& kernels)
+			: m_Structs(structs)
+			, m_Kernels(kernels)
+		{
+		}
+
+		bool Visit(const ComputeProcessor& processor, cmpNode& node)
+		{
+			// Only definitions can be launched
+			if (node.type != cmpNode_FunctionDefn || !IsKernelFunction(&node))
+				return true;
+
+			cmpNode* params_node = node.first_child;
+			while (params_node != 0 && params_node->type != cmpNode_FunctionParams)
+				params_node = params_node->next_sibling;
+			if (params_node == 0)
+				return true;
+
+			KernelInfo kernel;
+			kernel.name = GetFunctionName(&node);
+			ReflectParams(params_node, processor, m_Structs, kernel);
+			m_Kernels.push_back(kernel);
+			return true;
+		}
+
+	private:
+		const StructLayouts& m_Structs;
+		std::vector<KernelInfo>& m_Kernels;
+	};
+}
+
+
+bool IsKernelFunction(cmpNode* node)
+{
+	if (node->type != cmpNode_FunctionDefn && node->type != cmpNode_FunctionDecl)
+		return false;
+
+	TokenIterator ti(*node);
+	ti.SkipWhitespace();
+	if (ti.token == 0)
+		return false;
+
+	return ti.token->hash == KEYWORD_cmp_kernel_fn.hash;
+}
+
+
+std::string GetFunctionName(cmpNode* function_node)
+{
+	assert(function_node->type == cmpNode_FunctionDefn || function_node->type == cmpNode_FunctionDecl);
+
+	// Walk backwards until the first symbol is found
+	cmpToken* function_name_token = function_node->last_token;
+	while (function_name_token != NULL && function_name_token->type != cmpToken_Symbol)
+		function_name_token = function_name_token->prev;
+
+	// Use the symbol token to construct the name
+	assert(function_name_token != NULL);
+	std::string function_name(function_name_token->start, function_name_token->length);
+	return function_name;
+}
+
+
+void ReflectKernels(ComputeProcessor& processor, std::vector<KernelInfo>& kernels)
+{
+	// Structs passed by value need their layout
+	StructLayouts structs;
+	ComputeStructLayouts(processor, structs);
+
+	FindKernels find_kernels(structs, kernels);
+	processor.VisitNodes(&find_kernels);
+}
@@ -0,0 +1,92 @@
+
+#ifndef INCLUDED_KERNEL_REFLECTION_H
+#define INCLUDED_KERNEL_REFLECTION_H
+
+
+#include "StructLayout.h"
+
+
+// Argument index of parameters that aren't passed as arguments to the kernel
+static const cmpU32 KERNEL_NO_ARG = 0xFFFFFFFF;
+
+
+//
+// Kernel parameter as declared in the source, before any transforms, with its layout in the block of
+// arguments passed to the kernel on the selected target
+//
+struct KernelParam
+{
+	KernelParam()
+		: kind(0)
+		, address_space(0)
+		, dimensions(0)
+		, read_type(0)
+		, size(0)
+		, alignment(0)
+		, offset(0)
+		, arg_index(KERNEL_NO_ARG)
+	{
+	}
+
+	std::string name;
+
+	// Type tokens as written, without address space qualifiers
+	std::string type;
+
+	// 'v' for values, 'p' for pointers, 't' for textures and 's' for surfaces
+	char kind;
+
+	// 'g' for cmp_global, 'c' for cmp_constant, zero for neither
+	char address_space;
+
+	// Texture/surface properties, with 'u'/'n' read types for textures only
+	cmpU32 dimensions;
+	char read_type;
+
+	// Global variable generated for a texture/surface to be bound to, if any
+	std::string global_name;
+
+	// Zero size for parameters that aren't passed as arguments, such as CUDA textures
+	cmpU32 size;
+	cmpU32 alignment;
+	cmpU32 offset;
+
+	// Index among the arguments that are passed, which differs from the parameter index on CUDA
+	cmpU32 arg_index;
+};
+
+
+struct KernelInfo
+{
+	KernelInfo()
+		: nb_args(0)
+		, args_size(0)
+		, args_alignment(1)
+	{
+	}
+
+	std::string name;
+	std::vector<KernelParam> params;
+	cmpU32 nb_args;
+
+	// Size/alignment of all arguments packed together with the alignment of each, ready to be copied
+	// to the kernel in one go
+	cmpU32 args_size;
+	cmpU32 args_alignment;
+};
+
+
+bool IsKernelFunction(cmpNode* node);
+
+std::string GetFunctionName(cmpNode* function_node);
+
+
+//
+// Records the parameters of every kernel function definition in the source. Must be called before any
+// transforms replace the parameters. Value types are limited to the scalar and vector types of
+// cbpp/Math.h and the structs made from them, with other types given a size of LAYOUT_UNKNOWN.
+//
+void ReflectKernels(ComputeProcessor& processor, std::vector<KernelInfo>& kernels);
+
+
+#endif
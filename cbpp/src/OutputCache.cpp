@@ -0,0 +1,165 @@
+
+#include "OutputCache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+
+namespace
+{
+	bool HashFile(const std::string& filename, cmpU64& hash)
+	{
+		std::vector<char> file_data;
+		if (!LoadFileData(filename.c_str(), file_data))
+			return false;
+
+		hash = Hash64(file_data.data(), file_data.size());
+		return true;
+	}
+
+
+	cmpU64 CombineKey(cmpU64 key, cmpU64 hash)
+	{
+		return Hash64(&hash, sizeof(hash), key);
+	}
+
+
+	bool FileInfoTimeSort(const FileInfo& a, const FileInfo& b)
+	{
+		return a.modified_time < b.modified_time;
+	}
+}
+
+
+OutputCache::OutputCache(const std::string& directory, cmpU64 max_size)
+	: m_Directory(directory)
+	, m_MaxSize(max_size)
+{
+	// Create the cache directory on first use
+	FileInfo info;
+	if (!m_Directory.empty() && !GetFileInfo(m_Directory, info))
+		MakeDirectory(m_Directory);
+}
+
+
+bool OutputCache::Load(cmpU64 input_key, std::vector<char>& output, SideOutputs& side_outputs, std::vector<std::string>& included_files)
+{
+	if (m_Directory.empty())
+		return false;
+
+	// Each manifest line is the hash of an include file followed by its path
+	std::string manifest_path = EntryPath(input_key, "manifest");
+	std::vector<char> manifest;
+	if (!LoadFileData(manifest_path.c_str(), manifest))
+		return false;
+	manifest.push_back(0);
+
+	// Any include file that has changed or gone missing invalidates the manifest
+	cmpU64 key = input_key;
+	for (char* line = manifest.data(); *line != 0; )
+	{
+		char* end = strchr(line, '\n');
+		if (end == 0)
+			return false;
+		*end = 0;
+
+		char* path = strchr(line, ' ');
+		if (path == 0)
+			return false;
+		*path++ = 0;
+
+		cmpU64 hash;
+		if (!HashFile(path, hash) || hash != strtoull(line, 0, 16))
+			return false;
+		key = CombineKey(key, hash);
+		included_files.push_back(path);
+
+		line = end + 1;
+	}
+
+	// Restore the output
+	std::string output_path = EntryPath(key, "out");
+	if (!LoadFileData(output_path.c_str(), output))
+		return false;
+	for (SideOutputs::iterator i = side_outputs.begin(); i != side_outputs.end(); ++i)
+	{
+		if (!LoadFileData(EntryPath(key, i->first.c_str()).c_str(), i->second))
+			return false;
+	}
+
+	// Mark as recently used
+	TouchFile(manifest_path);
+	TouchFile(output_path);
+	for (SideOutputs::iterator i = side_outputs.begin(); i != side_outputs.end(); ++i)
+		TouchFile(EntryPath(key, i->first.c_str()));
+
+	return true;
+}
+
+
+void OutputCache::Store(cmpU64 input_key, const std::vector<std::string>& included_files, const std::vector<char>& output, const SideOutputs& side_outputs)
+{
+	if (m_Directory.empty())
+		return;
+
+	// Build the manifest and the key for the output at the same time
+	std::string manifest;
+	cmpU64 key = input_key;
+	for (size_t i = 0; i < included_files.size(); i++)
+	{
+		cmpU64 hash;
+		if (!HashFile(included_files[i], hash))
+			return;
+		key = CombineKey(key, hash);
+
+		char hash_text[32];
+		sprintf(hash_text, "%016llx ", hash);
+		manifest += hash_text;
+		manifest += included_files[i];
+		manifest += '\n';
+	}
+
+	// Write the output before the manifest that refers to it, replacing files atomically so that
+	// concurrent builds sharing the cache never see partial entries
+	if (!WriteFileIfChanged(EntryPath(key, "out"), output))
+		return;
+	for (SideOutputs::const_iterator i = side_outputs.begin(); i != side_outputs.end(); ++i)
+	{
+		if (!WriteFileIfChanged(EntryPath(key, i->first.c_str()), i->second))
+			return;
+	}
+	if (!WriteFileIfChanged(EntryPath(input_key, "manifest"), std::vector<char>(manifest.begin(), manifest.end())))
+		return;
+
+	Evict();
+}
+
+
+std::string OutputCache::EntryPath(cmpU64 key, const char* extension) const
+{
+	char filename[64];
+	sprintf(filename, "%016llx.%s", key, extension);
+	return JoinPaths(m_Directory, filename);
+}
+
+
+void OutputCache::Evict()
+{
+	std::vector<FileInfo> files;
+	if (!ListDirectory(m_Directory, files))
+		return;
+
+	cmpU64 total_size = 0;
+	for (size_t i = 0; i < files.size(); i++)
+		total_size += files[i].size;
+
+	// Remove the least recently used files until the cache fits
+	std::sort(files.begin(), files.end(), FileInfoTimeSort);
+	for (size_t i = 0; i < files.size() && total_size > m_MaxSize; i++)
+	{
+		if (remove(files[i].path.c_str()) == 0)
+			total_size -= files[i].size;
+	}
+}
@@ -0,0 +1,48 @@
+
+#ifndef INCLUDED_OUTPUT_CACHE_H
+#define INCLUDED_OUTPUT_CACHE_H
+
+
+#include "Base.h"
+
+#include <map>
+
+
+//
+// On-disk cache of generated output, addressed by the content it was generated from.
+//
+// The include files that an input depends on aren't known until it has been preprocessed so lookups
+// happen in two steps. The input key, built by the caller from everything known up-front, locates a
+// manifest listing the include files that were read when the output was stored. If they all still
+// hash the same, the input key combined with those hashes locates the stored output.
+//
+// Files are touched whenever they're used and the least recently used are evicted to keep the size
+// of the cache directory under its maximum. An empty directory name disables the cache.
+//
+class OutputCache
+{
+public:
+	// Files generated alongside the output, indexed by the extension they're stored with
+	typedef std::map<std::string, std::vector<char> > SideOutputs;
+
+	OutputCache(const std::string& directory, cmpU64 max_size);
+
+	// Retrieves the stored output for an input key, along with every side output already in the map
+	bool Load(cmpU64 input_key, std::vector<char>& output, SideOutputs& side_outputs, std::vector<std::string>& included_files);
+
+	// Failure to store is not an error as the output can always be regenerated
+	void Store(cmpU64 input_key, const std::vector<std::string>& included_files, const std::vector<char>& output, const SideOutputs& side_outputs);
+
+private:
+	std::string EntryPath(cmpU64 key, const char* extension) const;
+
+	void Evict();
+
+	std::string m_Directory;
+
+	// Maximum size of all files in the cache directory, in bytes
+	cmpU64 m_MaxSize;
+};
+
+
+#endif
@@ -0,0 +1,268 @@
+
+#include "PrecompiledHeader.h"
+
+#include <cstring>
+
+
+namespace
+{
+	// Identifies the file format, changing the version whenever the layout changes
+	const char FILE_MAGIC[8] = { 'c', 'b', 'p', 'c', 'h', 0, 0, 2 };
+
+
+	void Write(std::vector<char>& data, const void* src, size_t size)
+	{
+		const char* bytes = (const char*)src;
+		data.insert(data.end(), bytes, bytes + size);
+	}
+
+
+	void WriteU64(std::vector<char>& data, cmpU64 value)
+	{
+		Write(data, &value, sizeof(value));
+	}
+
+
+	void WriteString(std::vector<char>& data, const std::string& str)
+	{
+		WriteU64(data, str.length());
+		Write(data, str.data(), str.length());
+	}
+
+
+	//
+	// Reads values back from a loaded file, failing on any read past the end
+	//
+	struct Reader
+	{
+		Reader(const std::vector<char>& data)
+			: data(data)
+			, pos(0)
+		{
+		}
+
+		bool Read(void* dest, size_t size)
+		{
+			if (size > data.size() - pos)
+				return false;
+			memcpy(dest, data.data() + pos, size);
+			pos += size;
+			return true;
+		}
+
+		bool ReadU64(cmpU64& value)
+		{
+			return Read(&value, sizeof(value));
+		}
+
+		bool ReadString(std::string& str)
+		{
+			cmpU64 length;
+			if (!ReadU64(length) || length > data.size() - pos)
+				return false;
+			str.assign(data.data() + pos, (size_t)length);
+			pos += (size_t)length;
+			return true;
+		}
+
+		const std::vector<char>& data;
+		size_t pos;
+	};
+}
+
+
+void PrecompiledHeader::AddMacro(const fppMacro& macro)
+{
+	Macro m;
+	m.name = macro.name;
+	m.nb_args = macro.nargs;
+	m.has_replacement = macro.repl != 0;
+	if (m.has_replacement)
+		m.replacement = macro.repl;
+	m_Macros.push_back(m);
+}
+
+
+void PrecompiledHeader::AddGuard(const fppGuard& guard)
+{
+	Guard g;
+	g.filename = guard.filename;
+	g.has_macro = guard.guard != 0;
+	if (g.has_macro)
+		g.macro = guard.guard;
+	m_Guards.push_back(g);
+}
+
+
+bool PrecompiledHeader::AddFile(const std::string& path)
+{
+	FileInfo info;
+	if (!GetFileInfo(path, info))
+		return false;
+	m_Files.push_back(info);
+	return true;
+}
+
+
+void PrecompiledHeader::SetText(const std::vector<char>& text)
+{
+	m_Text = text;
+}
+
+
+bool PrecompiledHeader::IsUpToDate() const
+{
+	for (size_t i = 0; i < m_Files.size(); i++)
+	{
+		const FileInfo& recorded = m_Files[i];
+		FileInfo info;
+		if (!GetFileInfo(recorded.path, info) ||
+			info.size != recorded.size ||
+			info.modified_time != recorded.modified_time ||
+			info.modified_time_ns != recorded.modified_time_ns)
+			return false;
+	}
+
+	return true;
+}
+
+
+bool PrecompiledHeader::Save(const std::string& filename) const
+{
+	std::vector<char> data;
+	Write(data, FILE_MAGIC, sizeof(FILE_MAGIC));
+
+	WriteU64(data, m_Files.size());
+	for (size_t i = 0; i < m_Files.size(); i++)
+	{
+		WriteString(data, m_Files[i].path);
+		WriteU64(data, m_Files[i].size);
+		WriteU64(data, (cmpU64)m_Files[i].modified_time);
+		WriteU64(data, m_Files[i].modified_time_ns);
+	}
+
+	WriteU64(data, m_Macros.size());
+	for (size_t i = 0; i < m_Macros.size(); i++)
+	{
+		const Macro& macro = m_Macros[i];
+		WriteString(data, macro.name);
+		WriteU64(data, (cmpU64)macro.nb_args);
+		WriteU64(data, macro.has_replacement ? 1 : 0);
+		WriteString(data, macro.replacement);
+	}
+
+	WriteU64(data, m_Guards.size());
+	for (size_t i = 0; i < m_Guards.size(); i++)
+	{
+		const Guard& guard = m_Guards[i];
+		WriteString(data, guard.filename);
+		WriteU64(data, guard.has_macro ? 1 : 0);
+		WriteString(data, guard.macro);
+	}
+
+	WriteU64(data, m_Text.size());
+	Write(data, m_Text.data(), m_Text.size());
+
+	return WriteFileIfChanged(filename, data);
+}
+
+
+bool PrecompiledHeader::Load(const std::string& filename)
+{
+	std::vector<char> data;
+	if (!LoadFileData(filename.c_str(), data))
+		return false;
+
+	Reader reader(data);
+	char magic[sizeof(FILE_MAGIC)];
+	if (!reader.Read(magic, sizeof(magic)) || memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0)
+		return false;
+
+	cmpU64 nb_files;
+	if (!reader.ReadU64(nb_files))
+		return false;
+	m_Files.clear();
+	for (cmpU64 i = 0; i < nb_files; i++)
+	{
+		FileInfo info;
+		cmpU64 modified_time, modified_time_ns;
+		if (!reader.ReadString(info.path) ||
+			!reader.ReadU64(info.size) ||
+			!reader.ReadU64(modified_time) ||
+			!reader.ReadU64(modified_time_ns))
+			return false;
+		info.modified_time = (time_t)modified_time;
+		info.modified_time_ns = (cmpU32)modified_time_ns;
+		m_Files.push_back(info);
+	}
+
+	cmpU64 nb_macros;
+	if (!reader.ReadU64(nb_macros))
+		return false;
+	m_Macros.clear();
+	for (cmpU64 i = 0; i < nb_macros; i++)
+	{
+		Macro macro;
+		cmpU64 nb_args, has_replacement;
+		if (!reader.ReadString(macro.name) ||
+			!reader.ReadU64(nb_args) ||
+			!reader.ReadU64(has_replacement) ||
+			!reader.ReadString(macro.replacement))
+			return false;
+		macro.nb_args = (int)nb_args;
+		macro.has_replacement = has_replacement != 0;
+		m_Macros.push_back(macro);
+	}
+
+	cmpU64 nb_guards;
+	if (!reader.ReadU64(nb_guards))
+		return false;
+	m_Guards.clear();
+	for (cmpU64 i = 0; i < nb_guards; i++)
+	{
+		Guard guard;
+		cmpU64 has_macro;
+		if (!reader.ReadString(guard.filename) || !reader.ReadU64(has_macro) || !reader.ReadString(guard.macro))
+			return false;
+		guard.has_macro = has_macro != 0;
+		m_Guards.push_back(guard);
+	}
+
+	std::string text;
+	if (!reader.ReadString(text))
+		return false;
+	m_Text.assign(text.begin(), text.end());
+
+	return true;
+}
+
+
+void PrecompiledHeader::GetFppMacros(std::vector<fppMacro>& macros) const
+{
+	macros.resize(m_Macros.size() + 1);
+	for (size_t i = 0; i < m_Macros.size(); i++)
+	{
+		const Macro& macro = m_Macros[i];
+		macros[i].name = const_cast<char*>(macro.name.c_str());
+		macros[i].nargs = macro.nb_args;
+		macros[i].repl = macro.has_replacement ? const_cast<char*>(macro.replacement.c_str()) : 0;
+	}
+
+	// Terminate the list
+	macros.back().name = 0;
+}
+
+
+void PrecompiledHeader::GetFppGuards(std::vector<fppGuard>& guards) const
+{
+	guards.resize(m_Guards.size() + 1);
+	for (size_t i = 0; i < m_Guards.size(); i++)
+	{
+		const Guard& guard = m_Guards[i];
+		guards[i].filename = const_cast<char*>(guard.filename.c_str());
+		guards[i].guard = guard.has_macro ? const_cast<char*>(guard.macro.c_str()) : 0;
+	}
+
+	// Terminate the list
+	guards.back().filename = 0;
+}
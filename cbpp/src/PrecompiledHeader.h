@@ -0,0 +1,71 @@
+
+#ifndef INCLUDED_PRECOMPILED_HEADER_H
+#define INCLUDED_PRECOMPILED_HEADER_H
+
+
+#include "Base.h"
+#include "fcpp.h"
+
+
+//
+// Snapshot of the preprocessor state left after preprocessing a header: the macros it defined, the
+// files it found to be guarded against inclusion and the text it emitted. Restoring the snapshot
+// ahead of an input file gives the same result as preprocessing the header first, without paying
+// for it again.
+//
+// The size and modification time of every file read while preprocessing the header are recorded so
+// that a stored snapshot can be checked for changes before it's reused.
+//
+class PrecompiledHeader
+{
+public:
+	// Adds a macro reported by FPPTAG_DUMPMACROS
+	void AddMacro(const fppMacro& macro);
+
+	// Adds a guarded file reported by FPPTAG_DUMPGUARDS
+	void AddGuard(const fppGuard& guard);
+
+	// Returns false if the file no longer exists
+	bool AddFile(const std::string& path);
+
+	void SetText(const std::vector<char>& text);
+
+	// Checks that none of the files read by the header have changed
+	bool IsUpToDate() const;
+
+	bool Save(const std::string& filename) const;
+	bool Load(const std::string& filename);
+
+	// Builds a list of macros for FPPTAG_MACROS, pointing into this snapshot
+	void GetFppMacros(std::vector<fppMacro>& macros) const;
+
+	// Builds a list of guarded files for FPPTAG_GUARDS, pointing into this snapshot
+	void GetFppGuards(std::vector<fppGuard>& guards) const;
+
+	const std::vector<char>& Text() const { return m_Text; }
+	const std::vector<FileInfo>& Files() const { return m_Files; }
+
+private:
+	struct Macro
+	{
+		std::string name;
+		int nb_args;
+		bool has_replacement;
+		std::string replacement;
+	};
+
+	struct Guard
+	{
+		std::string filename;
+		bool has_macro;
+		std::string macro;
+	};
+
+	std::vector<Macro> m_Macros;
+	std::vector<Guard> m_Guards;
+	std::vector<FileInfo> m_Files;
+	std::vector<char> m_Text;
+};
+
+
+#endif
@@ -38,21 +38,27 @@ class PrologueTransform : public ITransform
 		tokens.Add(cmpToken_Whitespace, 0);
 		tokens.Add(cmpToken_EOL, 0);
 
-		// Create the containing user node (to be deleted by the parse tree)
-		cmpNode* node;
-		cmpError error = cmpNode_CreateEmpty(&node);
-		if (!cmpError_OK(&error))
-			throw error;
-		node->type = cmpNode_UserTokens;
-		node->first_token = tokens.first;
-		node->last_token = tokens.last;
+		// Texture types shared between files need the prologue macros before they can be included
+		std::string output_texture_types = processor.TargetProperty("-output_texture_types");
+		if (output_texture_types != "")
+		{
+			m_TextureTypesPath = "\"" + GetAbsolutePath(output_texture_types) + "\"";
+			tokens.Add(cmpToken_Hash, 0);
+			tokens.Add(STRING_include, 0);
+			tokens.Add(cmpToken_Whitespace, 0);
+			tokens.Add(m_TextureTypesPath, 0);
+			tokens.Add(cmpToken_Whitespace, 0);
+			tokens.Add(cmpToken_EOL, 0);
+		}
 
-		cmpNode_AddBefore(first_child, node);
+		// Start the file with a node that the processor takes ownership of
+		processor.InsertNodeBefore(first_child, tokens);
 
 		return cmpError_CreateOK();
 	}
 
 	String m_ProloguePath;
+	String m_TextureTypesPath;
 };
 
 
@@ -0,0 +1,295 @@
+
+#include "Server.h"
+#include "Base.h"
+
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <vector>
+
+
+#ifdef _WIN32
+
+
+int RunServer(const std::string& socket_path, CommandLineFunc command_line_func)
+{
+	printf("ERROR: Server mode is not supported on this platform\n");
+	return 1;
+}
+
+
+bool RunClient(const std::string& socket_path, int argc, const char* argv[], int& exit_code)
+{
+	return false;
+}
+
+
+#else
+
+
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+
+namespace
+{
+	// Limits on requests read from clients, well beyond any real command-line, so that a malformed
+	// message can't make the server allocate whatever size it claims
+	const cmpU32 MAX_NB_ARGS = 65536;
+	const cmpU32 MAX_STRING_LENGTH = 1024 * 1024;
+
+
+	bool SendAll(int fd, const void* data, size_t size)
+	{
+		const char* bytes = (const char*)data;
+		while (size != 0)
+		{
+			ssize_t sent = send(fd, bytes, size, 0);
+			if (sent <= 0)
+				return false;
+			bytes += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+
+	bool RecvAll(int fd, void* data, size_t size)
+	{
+		char* bytes = (char*)data;
+		while (size != 0)
+		{
+			ssize_t received = recv(fd, bytes, size, 0);
+			if (received <= 0)
+				return false;
+			bytes += received;
+			size -= received;
+		}
+		return true;
+	}
+
+
+	//
+	// All messages are made from 32-bit values and strings prefixed with their 32-bit length
+	//
+	bool SendU32(int fd, cmpU32 value)
+	{
+		return SendAll(fd, &value, sizeof(value));
+	}
+
+
+	bool SendString(int fd, const char* str, size_t length)
+	{
+		return SendU32(fd, (cmpU32)length) && SendAll(fd, str, length);
+	}
+
+
+	bool RecvU32(int fd, cmpU32& value)
+	{
+		return RecvAll(fd, &value, sizeof(value));
+	}
+
+
+	bool RecvString(int fd, std::string& str, cmpU32 max_length)
+	{
+		cmpU32 length;
+		if (!RecvU32(fd, length) || length > max_length)
+			return false;
+		str.resize(length);
+		return length == 0 || RecvAll(fd, &str[0], length);
+	}
+
+
+	bool InitAddress(const std::string& socket_path, sockaddr_un& address)
+	{
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		if (socket_path.length() >= sizeof(address.sun_path))
+		{
+			printf("ERROR: Socket path is too long: %s\n", socket_path.c_str());
+			return false;
+		}
+		strcpy(address.sun_path, socket_path.c_str());
+		return true;
+	}
+
+
+	int RunCommandLine(CommandLineFunc command_line_func, const std::vector<const char*>& argv)
+	{
+		// Anything thrown while processing fails the request rather than taking the server down
+		try
+		{
+			return command_line_func((int)argv.size(), const_cast<const char**>(argv.data()));
+		}
+		catch (const cmpError& error)
+		{
+			printf("ERROR: %s\n", cmpError_Text(&error));
+		}
+		catch (const std::exception& exception)
+		{
+			printf("ERROR: %s\n", exception.what());
+		}
+		catch (...)
+		{
+			printf("ERROR: Unknown exception while processing the command-line\n");
+		}
+		return 1;
+	}
+
+
+	int RunCapturingStdout(CommandLineFunc command_line_func, const std::vector<const char*>& argv, std::vector<char>& output)
+	{
+		// Point stdout at a temporary file for the duration of the command
+		FILE* capture = tmpfile();
+		if (capture == 0)
+			return RunCommandLine(command_line_func, argv);
+		fflush(stdout);
+		int saved_stdout = dup(STDOUT_FILENO);
+		dup2(fileno(capture), STDOUT_FILENO);
+
+		int exit_code = RunCommandLine(command_line_func, argv);
+
+		// Restore stdout and read back everything written
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+		long size = ftell(capture);
+		if (size > 0)
+		{
+			output.resize(size);
+			rewind(capture);
+			if (fread(output.data(), 1, size, capture) != (size_t)size)
+				output.clear();
+		}
+		fclose(capture);
+
+		return exit_code;
+	}
+
+
+	void ProcessRequest(int fd, CommandLineFunc command_line_func)
+	{
+		// Receive the working directory and command-line
+		std::string cwd;
+		cmpU32 argc;
+		if (!RecvString(fd, cwd, MAX_STRING_LENGTH) || !RecvU32(fd, argc) || argc > MAX_NB_ARGS)
+			return;
+		std::vector<std::string> args(argc);
+		for (cmpU32 i = 0; i < argc; i++)
+		{
+			if (!RecvString(fd, args[i], MAX_STRING_LENGTH))
+				return;
+		}
+		std::vector<const char*> argv(argc);
+		for (cmpU32 i = 0; i < argc; i++)
+			argv[i] = args[i].c_str();
+
+		// Relative paths on the command-line are relative to the client
+		std::vector<char> output;
+		int exit_code = 1;
+		if (chdir(cwd.c_str()) == 0)
+			exit_code = RunCapturingStdout(command_line_func, argv, output);
+		else
+		{
+			const char error[] = "ERROR: Server can't change to the client's working directory\n";
+			output.assign(error, error + sizeof(error) - 1);
+		}
+
+		if (SendU32(fd, (cmpU32)exit_code))
+			SendString(fd, output.data(), output.size());
+	}
+}
+
+
+int RunServer(const std::string& socket_path, CommandLineFunc command_line_func)
+{
+	sockaddr_un address;
+	if (!InitAddress(socket_path, address))
+		return 1;
+
+	// Clients disconnecting early shouldn't take the server down
+	signal(SIGPIPE, SIG_IGN);
+
+	int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server_fd < 0)
+	{
+		printf("ERROR: Failed to create server socket\n");
+		return 1;
+	}
+
+	// Replace any socket left behind by a previous server
+	unlink(socket_path.c_str());
+	if (bind(server_fd, (sockaddr*)&address, sizeof(address)) != 0 || listen(server_fd, 16) != 0)
+	{
+		printf("ERROR: Failed to listen on socket %s\n", socket_path.c_str());
+		close(server_fd);
+		return 1;
+	}
+
+	// Requests are processed one at a time
+	while (true)
+	{
+		int client_fd = accept(server_fd, 0, 0);
+		if (client_fd < 0)
+			continue;
+
+		// A request that can't be handled only fails its own client
+		try
+		{
+			ProcessRequest(client_fd, command_line_func);
+		}
+		catch (...)
+		{
+		}
+		close(client_fd);
+	}
+}
+
+
+bool RunClient(const std::string& socket_path, int argc, const char* argv[], int& exit_code)
+{
+	sockaddr_un address;
+	if (!InitAddress(socket_path, address))
+		return false;
+
+	// A server that goes away mid-request is reported rather than ending the process
+	signal(SIGPIPE, SIG_IGN);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return false;
+	if (connect(fd, (sockaddr*)&address, sizeof(address)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	// Send the request
+	std::string cwd = GetCurrentWorkingDirectory();
+	bool sent = SendString(fd, cwd.c_str(), cwd.length()) && SendU32(fd, argc);
+	for (int i = 0; i < argc && sent; i++)
+		sent = SendString(fd, argv[i], strlen(argv[i]));
+
+	// Wait for the exit code and output of the command
+	cmpU32 server_exit_code;
+	std::string output;
+	bool received = sent && RecvU32(fd, server_exit_code) && RecvString(fd, output, 0xFFFFFFFF);
+	close(fd);
+
+	// The server may have started on the command, so it's not run again here
+	if (!received)
+	{
+		printf("ERROR: Lost the connection to the server at %s\n", socket_path.c_str());
+		exit_code = 1;
+		return true;
+	}
+
+	fwrite(output.data(), 1, output.length(), stdout);
+	exit_code = (int)server_exit_code;
+	return true;
+}
+
+
+#endif
@@ -0,0 +1,31 @@
+
+#ifndef INCLUDED_SERVER_H
+#define INCLUDED_SERVER_H
+
+
+#include <string>
+
+
+//
+// Runs a complete cbpp command-line, returning the process exit code
+//
+typedef int (*CommandLineFunc)(int argc, const char* argv[]);
+
+
+//
+// Keeps cbpp resident, listening on a Unix domain socket for clients that send their working directory
+// and command-line. Each request is run in the client's working directory with everything written to
+// stdout captured and sent back alongside the exit code. Only returns if the socket can't be created.
+//
+int RunServer(const std::string& socket_path, CommandLineFunc command_line_func);
+
+
+//
+// Sends a command-line to a server for processing, printing its output. Returns false if the server
+// couldn't be connected to so that the caller can fall back to processing the command-line itself.
+// Failures after connecting are reported with an exit code of 1, as the server may have started work.
+//
+bool RunClient(const std::string& socket_path, int argc, const char* argv[], int& exit_code);
+
+
+#endif
@@ -0,0 +1,170 @@
+
+#include "SourceMap.h"
+
+
+namespace
+{
+	// Identifies the file format, changing the version whenever the layout changes
+	const char FILE_MAGIC[8] = { 'c', 'b', 's', 'm', 'a', 'p', 0, 1 };
+
+
+	// Marks preprocessed lines with no known original location
+	const cmpU32 NO_FILE = 0xFFFFFFFF;
+
+
+	// Written a byte at a time so that the file is the same on any host
+	void WriteU32(std::vector<char>& data, cmpU32 value)
+	{
+		for (int i = 0; i < 4; i++)
+			data.push_back((char)(value >> (i * 8)));
+	}
+
+
+	const char* SkipBlanks(const char* text, const char* end)
+	{
+		while (text < end && (*text == ' ' || *text == '\t'))
+			text++;
+		return text;
+	}
+
+
+	//
+	// Parses a "#line N" or "#line N "file"" directive, as written by fcpp, leaving the filename
+	// empty if it's not present
+	//
+	bool ParseLineDirective(const char* text, const char* end, cmpU32& line, std::string& filename)
+	{
+		text = SkipBlanks(text, end);
+		if (text == end || *text != '#')
+			return false;
+		text = SkipBlanks(text + 1, end);
+		if (end - text >= 4 && text[0] == 'l' && text[1] == 'i' && text[2] == 'n' && text[3] == 'e')
+			text = SkipBlanks(text + 4, end);
+
+		if (text == end || *text < '0' || *text > '9')
+			return false;
+		line = 0;
+		while (text < end && *text >= '0' && *text <= '9')
+			line = line * 10 + (*text++ - '0');
+
+		filename.clear();
+		text = SkipBlanks(text, end);
+		if (text < end && *text == '"')
+		{
+			const char* name_end = end;
+			while (name_end > text + 1 && name_end[-1] != '"')
+				name_end--;
+			if (name_end > text + 1)
+				filename.assign(text + 1, name_end - 1);
+		}
+
+		return true;
+	}
+}
+
+
+void SourceMap::SetPreProcessedText(const std::vector<char>& text)
+{
+	m_Lines.clear();
+
+	Location location(NO_FILE, 0);
+	const char* data = text.data();
+	const char* data_end = data + text.size();
+	while (data < data_end)
+	{
+		const char* line_end = data;
+		while (line_end < data_end && *line_end != '\n')
+			line_end++;
+
+		// Directives locate the line that follows them, with the file only given when it changes
+		cmpU32 line;
+		std::string filename;
+		if (ParseLineDirective(data, line_end, line, filename))
+		{
+			if (filename != "")
+				location.file_index = AddFilename(filename);
+			location.line = line;
+			m_Lines.push_back(Location(NO_FILE, 0));
+		}
+		else
+		{
+			m_Lines.push_back(location);
+			if (location.file_index != NO_FILE)
+				location.line++;
+		}
+
+		data = line_end + 1;
+	}
+}
+
+
+bool SourceMap::Locate(cmpU32 pp_line, cmpU32& file_index, cmpU32& line) const
+{
+	if (pp_line == 0 || pp_line > m_Lines.size())
+		return false;
+
+	const Location& location = m_Lines[pp_line - 1];
+	if (location.file_index == NO_FILE)
+		return false;
+
+	file_index = location.file_index;
+	line = location.line;
+	return true;
+}
+
+
+void SourceMap::AddEntry(cmpU32 offset, cmpU32 file_index, cmpU32 line)
+{
+	if (!m_Entries.empty())
+	{
+		Entry& last = m_Entries.back();
+		if (last.location.file_index == file_index && last.location.line == line)
+			return;
+
+		// A later entry at the same offset replaces the earlier one
+		if (last.offset == offset)
+		{
+			last.location = Location(file_index, line);
+			return;
+		}
+	}
+
+	Entry entry = { offset, Location(file_index, line) };
+	m_Entries.push_back(entry);
+}
+
+
+void SourceMap::Write(std::vector<char>& data) const
+{
+	data.insert(data.end(), FILE_MAGIC, FILE_MAGIC + sizeof(FILE_MAGIC));
+	WriteU32(data, (cmpU32)m_Filenames.size());
+	WriteU32(data, (cmpU32)m_Entries.size());
+
+	for (size_t i = 0; i < m_Filenames.size(); i++)
+	{
+		const std::string& filename = m_Filenames[i];
+		WriteU32(data, (cmpU32)filename.length());
+		data.insert(data.end(), filename.begin(), filename.end());
+	}
+
+	for (size_t i = 0; i < m_Entries.size(); i++)
+	{
+		const Entry& entry = m_Entries[i];
+		WriteU32(data, entry.offset);
+		WriteU32(data, entry.location.file_index);
+		WriteU32(data, entry.location.line);
+	}
+}
+
+
+cmpU32 SourceMap::AddFilename(const std::string& filename)
+{
+	for (size_t i = 0; i < m_Filenames.size(); i++)
+	{
+		if (m_Filenames[i] == filename)
+			return (cmpU32)i;
+	}
+
+	m_Filenames.push_back(filename);
+	return (cmpU32)(m_Filenames.size() - 1);
+}
@@ -0,0 +1,75 @@
+
+#ifndef INCLUDED_SOURCE_MAP_H
+#define INCLUDED_SOURCE_MAP_H
+
+
+#include "Base.h"
+
+
+//
+// Maps offsets in generated output back to the lines of the original files they came from.
+//
+// The #line directives that fcpp writes to its output locate every preprocessed line in its original
+// file. Tokens remember the preprocessed line they were read from, including those generated by the
+// transforms, so the location of each emitted token can be looked up and recorded against its offset
+// in the output. Generated tokens borrow the line of nearby code, so those starting an output line are
+// recorded against the line of the first token on it from the input, the same line any #line directive
+// gives it. Entries are only added where the location changes.
+//
+// The binary file is made from little-endian 32-bit values:
+//
+//    magic      8 bytes, "cbsmap" followed by the version
+//    nb_files   Number of original files
+//    nb_entries Number of offset entries
+//    files      Length of each file path followed by its characters
+//    entries    Output offset, file index and line of each entry, sorted by offset
+//
+// Each entry covers the output from its offset up to the offset of the next entry.
+//
+class SourceMap
+{
+public:
+	// Reads the #line directives from the output of the preprocessor
+	void SetPreProcessedText(const std::vector<char>& text);
+
+	// Returns false if the original location of the preprocessed line isn't known
+	bool Locate(cmpU32 pp_line, cmpU32& file_index, cmpU32& line) const;
+
+	// Records that output from the offset onwards comes from the original file and line
+	void AddEntry(cmpU32 offset, cmpU32 file_index, cmpU32 line);
+
+	void Write(std::vector<char>& data) const;
+
+	const std::string& Filename(cmpU32 file_index) const { return m_Filenames[file_index]; }
+
+private:
+	struct Location
+	{
+		Location(cmpU32 file_index, cmpU32 line)
+			: file_index(file_index)
+			, line(line)
+		{
+		}
+
+		cmpU32 file_index;
+		cmpU32 line;
+	};
+
+	struct Entry
+	{
+		cmpU32 offset;
+		Location location;
+	};
+
+	cmpU32 AddFilename(const std::string& filename);
+
+	std::vector<std::string> m_Filenames;
+
+	// Original location of each preprocessed line, indexed from line 1
+	std::vector<Location> m_Lines;
+
+	std::vector<Entry> m_Entries;
+};
+
+
+#endif
@@ -0,0 +1,570 @@
+
+#include "StructLayout.h"
+#include "KernelParamsWriter.h"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+
+
+namespace
+{
+	HashString KEYWORD_static("static");
+	HashString KEYWORD_public("public");
+	HashString KEYWORD_private("private");
+	HashString KEYWORD_protected("protected");
+
+
+	//
+	// Scalar types in cbpp/Math.h with the host types that mirror them. OpenCL fixes the size of each
+	// of them but CUDA's long follows the host compiler, making it 4 bytes on Windows and 8 bytes on
+	// 64-bit Linux and OS X. CUDA longs are given the size from -cuda_long_size and mirrored with a
+	// host long, so that the host compiler checks any difference.
+	//
+	struct ScalarType
+	{
+		const char* name;
+		cmpU32 size;
+		const char* host_type;
+
+		// Host type that mirrors the CUDA type instead, when its size is that of the host type
+		const char* cuda_host_type;
+	};
+	const ScalarType SCALAR_TYPES[] =
+	{
+		{ "char", 1, "std::int8_t", 0 }, { "uchar", 1, "std::uint8_t", 0 },
+		{ "short", 2, "std::int16_t", 0 }, { "ushort", 2, "std::uint16_t", 0 },
+		{ "int", 4, "std::int32_t", 0 }, { "uint", 4, "std::uint32_t", 0 },
+		{ "long", 8, "std::int64_t", "long" }, { "ulong", 8, "std::uint64_t", "unsigned long" },
+		{ "longlong", 8, "std::int64_t", 0 }, { "ulonglong", 8, "std::uint64_t", 0 },
+		{ "float", 4, "float", 0 }, { "double", 8, "double", 0 },
+	};
+
+
+	bool IsWordChar(char c)
+	{
+		return isalnum((unsigned char)c) || c == '_';
+	}
+
+
+	bool IsSkippedToken(const cmpToken* token)
+	{
+		return token->type == cmpToken_Whitespace || token->type == cmpToken_EOL || token->type == cmpToken_Comment;
+	}
+
+
+	cmpU32 Align(cmpU32 offset, cmpU32 alignment)
+	{
+		return (offset + alignment - 1) & ~(alignment - 1);
+	}
+
+
+	//
+	// Gets the layout of a scalar or vector type on the target, as given by the alignment requirements
+	// of CUDA's vector types and OpenCL's rule that 3-component vectors have the size and alignment of
+	// 4-component ones
+	//
+	bool GetValueLayout(const std::string& type, const ComputeProcessor& processor, TypeLayout& layout)
+	{
+		ComputeTarget target = processor.Target();
+
+		// Split off any vector component count
+		size_t digits = type.length();
+		while (digits > 0 && isdigit((unsigned char)type[digits - 1]))
+			digits--;
+		std::string scalar = type.substr(0, digits);
+		cmpU32 nb_components = digits == type.length() ? 1 : atoi(type.c_str() + digits);
+
+		const ScalarType* scalar_type = 0;
+		for (size_t i = 0; i < sizeof(SCALAR_TYPES) / sizeof(SCALAR_TYPES[0]); i++)
+		{
+			if (scalar == SCALAR_TYPES[i].name)
+				scalar_type = SCALAR_TYPES + i;
+		}
+		if (scalar_type == 0)
+			return false;
+
+		cmpU32 scalar_size = scalar_type->size;
+		layout.host_type = scalar_type->host_type;
+		if (target == ComputeTarget_CUDA && scalar_type->cuda_host_type != 0)
+		{
+			scalar_size = processor.LongSize();
+			layout.host_type = scalar_type->cuda_host_type;
+		}
+		switch (nb_components)
+		{
+			case 1:
+			case 2:
+				layout.nb_components = nb_components;
+				layout.size = scalar_size * nb_components;
+				layout.alignment = layout.size;
+				return true;
+
+			case 3:
+				if (target == ComputeTarget_OpenCL)
+				{
+					layout.nb_components = 4;
+					layout.size = scalar_size * 4;
+					layout.alignment = layout.size;
+				}
+				else
+				{
+					layout.nb_components = 3;
+					layout.size = scalar_size * 3;
+					layout.alignment = scalar_size;
+				}
+				return true;
+
+			case 4:
+				layout.nb_components = 4;
+				layout.size = scalar_size * 4;
+				layout.alignment = layout.size;
+				if (target != ComputeTarget_OpenCL && layout.alignment > 16)
+					layout.alignment = 16;
+				return true;
+		}
+
+		return false;
+	}
+
+
+	//
+	// Reduces type tokens to the name of a single type, dropping qualifiers and converting the
+	// signed/unsigned forms of the scalar types to their Math.h names, or to CUDA's longlong
+	//
+	std::string GetTypeName(const std::vector<cmpToken*>& type_tokens)
+	{
+		bool is_unsigned = false;
+		std::string name;
+		for (size_t i = 0; i < type_tokens.size(); i++)
+		{
+			if (type_tokens[i]->type == cmpToken_Struct)
+				continue;
+
+			std::string text(type_tokens[i]->start, type_tokens[i]->length);
+			if (text == "const" || text == "volatile" || text == "signed")
+				continue;
+			if (text == "unsigned")
+			{
+				is_unsigned = true;
+				continue;
+			}
+
+			// "long int" is the same as "long", "short int" is "short" and "long long int" is "long long"
+			if (text == "int" && (name == "long" || name == "short" || name == "longlong"))
+				continue;
+			if (text == "long" && name == "long")
+			{
+				name = "longlong";
+				continue;
+			}
+
+			if (name != "")
+				return "";
+			name = text;
+		}
+
+		if (is_unsigned)
+			name = "u" + (name == "" ? std::string("int") : name);
+		return name;
+	}
+
+
+	const StructLayout* FindStructLayout(const StructLayouts& layouts, const std::string& name)
+	{
+		for (size_t i = 0; i < layouts.size(); i++)
+		{
+			if (layouts[i].name == name || layouts[i].tag == name)
+				return &layouts[i];
+		}
+		return 0;
+	}
+
+
+	// Gathers the tokens of a node and its children in source order, leaving out whitespace and semi-colons
+	void GatherTokens(cmpNode* node, std::vector<cmpToken*>& tokens)
+	{
+		for (TokenIterator i(*node); i; ++i)
+		{
+			if (!IsSkippedToken(i.token) && i.token->type != cmpToken_SemiColon)
+				tokens.push_back(i.token);
+		}
+		for (cmpNode* child = node->first_child; child != 0; child = child->next_sibling)
+			GatherTokens(child, tokens);
+	}
+
+
+	//
+	// Adds the members declared by a statement such as "float a, *b, c[4];", which all share the type
+	// specifiers of the first declarator. Returns false with an error set on the layout if they can't be
+	// laid out.
+	//
+	bool AddMembers(cmpNode* statement, const ComputeProcessor& processor, const StructLayouts& structs, StructLayout& layout)
+	{
+		std::vector<cmpToken*> tokens;
+		GatherTokens(statement, tokens);
+
+		// Access specifiers are parsed as part of the statement that follows them
+		while (tokens.size() >= 2 && tokens[1]->type == cmpToken_Colon &&
+			(tokens[0]->hash == KEYWORD_public.hash || tokens[0]->hash == KEYWORD_private.hash || tokens[0]->hash == KEYWORD_protected.hash))
+			tokens.erase(tokens.begin(), tokens.begin() + 2);
+
+		// Static members aren't stored in the struct
+		if (tokens.empty() || tokens[0]->hash == KEYWORD_static.hash)
+			return true;
+
+		std::vector<cmpToken*> base_type_tokens;
+		size_t start = 0;
+		while (start < tokens.size())
+		{
+			// Find the end of the declarator and the start of any initialiser
+			size_t end = start, init = tokens.size();
+			int depth = 0;
+			for (; end < tokens.size(); end++)
+			{
+				cmpTokenType type = tokens[end]->type;
+				if (type == cmpToken_LBracket || type == cmpToken_LSqBracket || type == cmpToken_LAngle || type == cmpToken_LBrace)
+					depth++;
+				else if (type == cmpToken_RBracket || type == cmpToken_RSqBracket || type == cmpToken_RAngle || type == cmpToken_RBrace)
+					depth--;
+				else if (type == cmpToken_Comma && depth == 0)
+					break;
+				else if (type == cmpToken_Equals && depth == 0 && init == tokens.size())
+					init = end;
+			}
+			if (init > end)
+				init = end;
+
+			// The name is the last symbol before any array bounds
+			size_t name_index = init;
+			size_t bounds_index = init;
+			for (size_t i = start; i < init; i++)
+			{
+				if (tokens[i]->type == cmpToken_LSqBracket)
+				{
+					bounds_index = i;
+					break;
+				}
+				if (tokens[i]->type == cmpToken_Colon)
+				{
+					layout.error = "bit-fields aren't supported";
+					return false;
+				}
+				if (tokens[i]->type == cmpToken_Symbol)
+					name_index = i;
+			}
+			if (name_index == init)
+			{
+				layout.error = "a member has no name";
+				return false;
+			}
+
+			StructMember member;
+			member.name = std::string(tokens[name_index]->start, tokens[name_index]->length);
+
+			// Later declarators reuse the specifiers of the first, leaving its pointers behind
+			std::vector<cmpToken*> type_tokens;
+			if (start == 0)
+			{
+				for (size_t i = 0; i < name_index; i++)
+				{
+					if (tokens[i]->type != cmpToken_Asterisk)
+						base_type_tokens.push_back(tokens[i]);
+				}
+				type_tokens.assign(tokens.begin(), tokens.begin() + name_index);
+			}
+			else
+			{
+				type_tokens = base_type_tokens;
+				type_tokens.insert(type_tokens.end(), tokens.begin() + start, tokens.begin() + name_index);
+			}
+			member.type = GetTypeText(type_tokens);
+
+			// Multiply out the bounds of each array dimension
+			for (size_t i = bounds_index; i < init; i += 3)
+			{
+				if (i + 2 >= init || tokens[i]->type != cmpToken_LSqBracket || tokens[i + 1]->type != cmpToken_Number || tokens[i + 2]->type != cmpToken_RSqBracket)
+				{
+					layout.error = "member '" + member.name + "' doesn't have a constant array size";
+					return false;
+				}
+				member.nb_elements *= strtoul(std::string(tokens[i + 1]->start, tokens[i + 1]->length).c_str(), 0, 0);
+			}
+
+			if (!GetTypeLayout(type_tokens, processor, structs, member.layout))
+			{
+				layout.error = "member '" + member.name + "' has type '" + member.type + "' with no known layout";
+				return false;
+			}
+
+			layout.members.push_back(member);
+			start = end + 1;
+		}
+
+		return true;
+	}
+
+
+	void LayOutStruct(cmpNode* block, const ComputeProcessor& processor, const StructLayouts& structs, StructLayout& layout)
+	{
+		for (cmpNode* child = block->first_child; child != 0; child = child->next_sibling)
+		{
+			if (child->type == cmpNode_StructDefn)
+			{
+				layout.error = "nested struct definitions aren't supported";
+				return;
+			}
+
+			// Members can be declared with "struct Name member;", with functions not changing the layout
+			if ((child->type == cmpNode_Statement || child->type == cmpNode_StructDecl) && !AddMembers(child, processor, structs, layout))
+				return;
+		}
+
+		if (layout.members.empty())
+		{
+			layout.error = "it has no members";
+			return;
+		}
+
+		// Place each member at the next offset that satisfies its alignment
+		cmpU32 offset = 0;
+		layout.alignment = 1;
+		for (size_t i = 0; i < layout.members.size(); i++)
+		{
+			StructMember& member = layout.members[i];
+			offset = Align(offset, member.layout.alignment);
+			member.offset = offset;
+			offset += member.layout.size * member.nb_elements;
+			if (member.layout.alignment > layout.alignment)
+				layout.alignment = member.layout.alignment;
+		}
+		layout.size = Align(offset, layout.alignment);
+	}
+
+
+	class FindStructs : public INodeVisitor
+	{
+	public:
+		FindStructs(StructLayouts& layouts)
+			: m_Layouts(layouts)
+		{
+		}
+
+		bool Visit(const ComputeProcessor& processor, cmpNode& node)
+		{
+			if (node.type != cmpNode_StructDefn)
+				return true;
+
+			// Typedef names are preferred to tags, with the struct found by either
+			StructLayout layout;
+			cmpNode* block = 0;
+			for (cmpNode* child = node.first_child; child != 0; child = child->next_sibling)
+			{
+				if (child->type == cmpNode_StructName)
+					layout.name = std::string(child->first_token->start, child->first_token->length);
+				else if (child->type == cmpNode_StructTag)
+					layout.tag = std::string(child->first_token->start, child->first_token->length);
+				else if (child->type == cmpNode_StatementBlock)
+					block = child;
+			}
+			if (layout.name == "")
+				layout.name.swap(layout.tag);
+			else if (layout.tag == layout.name)
+				layout.tag = "";
+
+			// Anonymous structs can't be mirrored and the first definition of a name wins
+			if (layout.name == "" || block == 0 || FindStructLayout(m_Layouts, layout.name) != 0)
+				return true;
+			if (layout.tag != "" && FindStructLayout(m_Layouts, layout.tag) != 0)
+				return true;
+
+			LayOutStruct(block, processor, m_Layouts, layout);
+			m_Layouts.push_back(layout);
+			return true;
+		}
+
+	private:
+		StructLayouts& m_Layouts;
+	};
+
+
+	std::string FormatU32(cmpU32 value)
+	{
+		char text[16];
+		sprintf(text, "%u", value);
+		return text;
+	}
+}
+
+
+std::string GetTypeText(const std::vector<cmpToken*>& type_tokens)
+{
+	// Spaces are only needed where they separate words
+	std::string text;
+	for (size_t i = 0; i < type_tokens.size(); i++)
+	{
+		const cmpToken* token = type_tokens[i];
+		if (!text.empty() && IsWordChar(text[text.length() - 1]) && IsWordChar(token->start[0]))
+			text += ' ';
+		text.append(token->start, token->length);
+	}
+	return text;
+}
+
+
+bool GetTypeLayout(const std::vector<cmpToken*>& type_tokens, const ComputeProcessor& processor, const StructLayouts& structs, TypeLayout& layout)
+{
+	layout = TypeLayout();
+
+	// Device pointers are 64-bit on all supported targets
+	for (size_t i = 0; i < type_tokens.size(); i++)
+	{
+		if (type_tokens[i]->type == cmpToken_Asterisk)
+		{
+			layout.name = GetTypeText(type_tokens);
+			layout.host_type = "std::uint64_t";
+			layout.nb_components = 1;
+			layout.size = 8;
+			layout.alignment = 8;
+			return true;
+		}
+	}
+
+	layout.name = GetTypeName(type_tokens);
+	if (layout.name == "")
+		return false;
+	if (GetValueLayout(layout.name, processor, layout))
+		return true;
+
+	const StructLayout* struct_layout = FindStructLayout(structs, layout.name);
+	if (struct_layout == 0 || struct_layout->error != "")
+		return false;
+
+	// Structs found by their tag are mirrored under their typedef name
+	layout.name = struct_layout->name;
+	layout.size = struct_layout->size;
+	layout.alignment = struct_layout->alignment;
+	return true;
+}
+
+
+void ComputeStructLayouts(ComputeProcessor& processor, StructLayouts& layouts)
+{
+	FindStructs find_structs(layouts);
+	processor.VisitNodes(&find_structs);
+}
+
+
+void WriteStructLayoutHeader(const StructLayouts& layouts, const std::string& input_filename, ComputeTarget target, std::vector<char>& data)
+{
+	const char* target_name = ComputeTargetName(target);
+	std::string namespace_name = GetHeaderNamespace(input_filename, target_name);
+	std::string guard = "INCLUDED_CBPP_" + namespace_name + "_STRUCTS_H";
+	for (size_t i = 0; i < guard.length(); i++)
+		guard[i] = toupper((unsigned char)guard[i]);
+
+	std::string text;
+	text += "\n";
+	text += "//\n";
+	text += "// Host mirrors of the structs in " + GetHeaderInputName(input_filename) + ", generated by cbpp with the layout they have on " + target_name + ".\n";
+	text += "// Padding is explicit and vectors are arrays of their components, including any padding components.\n";
+	text += "//\n";
+	text += "\n";
+	text += "#ifndef " + guard + "\n";
+	text += "#define " + guard + "\n";
+	text += "\n\n";
+	text += "#include <cstddef>\n";
+	text += "#include <cstdint>\n";
+	text += "\n\n";
+	text += "namespace cbpp {\n";
+	text += "namespace " + namespace_name + " {\n";
+	text += "namespace structs\n";
+	text += "{\n";
+
+	for (size_t i = 0; i < layouts.size(); i++)
+	{
+		const StructLayout& layout = layouts[i];
+		if (i != 0)
+			text += "\n";
+		if (layout.error != "")
+		{
+			text += "\t// " + layout.name + " is left out as " + layout.error + "\n";
+			continue;
+		}
+
+		text += "\tstruct alignas(" + FormatU32(layout.alignment) + ") " + layout.name + "\n";
+		text += "\t{\n";
+
+		cmpU32 offset = 0;
+		cmpU32 nb_pads = 0;
+		for (size_t j = 0; j < layout.members.size(); j++)
+		{
+			const StructMember& member = layout.members[j];
+			if (member.offset > offset)
+				text += "\t\tstd::uint8_t _pad" + FormatU32(nb_pads++) + "[" + FormatU32(member.offset - offset) + "];\n";
+
+			const TypeLayout& type = member.layout;
+			std::string declaration = type.host_type != 0 ? type.host_type : type.name;
+			declaration += " " + member.name;
+			if (member.nb_elements > 1)
+				declaration += "[" + FormatU32(member.nb_elements) + "]";
+			if (type.nb_components > 1)
+				declaration += "[" + FormatU32(type.nb_components) + "]";
+			declaration += ";";
+			if (type.host_type != 0 && member.type != type.host_type)
+				declaration += " // " + member.type;
+			text += "\t\t" + declaration + "\n";
+
+			offset = member.offset + type.size * member.nb_elements;
+		}
+		if (layout.size > offset)
+			text += "\t\tstd::uint8_t _pad" + FormatU32(nb_pads++) + "[" + FormatU32(layout.size - offset) + "];\n";
+
+		text += "\t};\n";
+		std::string message = "\"" + layout.name + " doesn't match its " + target_name + " layout\"";
+		text += "\tstatic_assert(sizeof(" + layout.name + ") == " + FormatU32(layout.size) + ", " + message + ");\n";
+		text += "\tstatic_assert(alignof(" + layout.name + ") == " + FormatU32(layout.alignment) + ", " + message + ");\n";
+		for (size_t j = 0; j < layout.members.size(); j++)
+		{
+			const StructMember& member = layout.members[j];
+			text += "\tstatic_assert(offsetof(" + layout.name + ", " + member.name + ") == " + FormatU32(member.offset) + ", " + message + ");\n";
+		}
+	}
+
+	text += "}\n";
+	text += "}\n";
+	text += "}\n";
+	text += "\n";
+	text += "\n";
+	text += "#endif\n";
+
+	data.assign(text.begin(), text.end());
+}
+
+
+class StructLayoutTransform : public ITransform
+{
+	cmpError Apply(ComputeProcessor& processor)
+	{
+		// The absence of an output filename is not an error
+		std::string output_structs = processor.TargetProperty("-output_structs");
+		if (output_structs == "")
+			return cmpError_CreateOK();
+
+		StructLayouts layouts;
+		ComputeStructLayouts(processor, layouts);
+
+		// Leave the file untouched if nothing has changed
+		std::vector<char> data;
+		WriteStructLayoutHeader(layouts, processor.InputFilename(), processor.Target(), data);
+		if (!WriteFileIfChanged(output_structs, data))
+			return cmpError_Create("Failed to write to output structs file '%s'", output_structs.c_str());
+
+		return cmpError_CreateOK();
+	}
+};
+
+
+// Register transform
+static TransformDesc<StructLayoutTransform> g_Transform;
@@ -0,0 +1,115 @@
+
+#ifndef INCLUDED_STRUCT_LAYOUT_H
+#define INCLUDED_STRUCT_LAYOUT_H
+
+
+#include "ComputeProcessor.h"
+
+
+// Marks sizes, alignments and offsets that can't be worked out
+static const cmpU32 LAYOUT_UNKNOWN = 0xFFFFFFFF;
+
+
+//
+// Layout of a type on the selected target. Values are the scalar and vector types of cbpp/Math.h,
+// where the size includes any padding the target adds after the last vector component.
+//
+struct TypeLayout
+{
+	TypeLayout()
+		: host_type(0)
+		, nb_components(0)
+		, size(LAYOUT_UNKNOWN)
+		, alignment(LAYOUT_UNKNOWN)
+	{
+	}
+
+	// Math.h or struct type name, with qualifiers removed
+	std::string name;
+
+	// Fixed-width host type of each component, null for structs
+	const char* host_type;
+
+	// Components the size is made from, including padding, zero for structs
+	cmpU32 nb_components;
+
+	cmpU32 size;
+	cmpU32 alignment;
+};
+
+
+struct StructMember
+{
+	StructMember()
+		: nb_elements(1)
+		, offset(LAYOUT_UNKNOWN)
+	{
+	}
+
+	std::string name;
+
+	// Type as written in the source
+	std::string type;
+
+	TypeLayout layout;
+
+	// Multi-dimensional arrays are flattened
+	cmpU32 nb_elements;
+
+	cmpU32 offset;
+};
+
+
+struct StructLayout
+{
+	StructLayout()
+		: size(LAYOUT_UNKNOWN)
+		, alignment(LAYOUT_UNKNOWN)
+	{
+	}
+
+	// Typedef name if there is one, otherwise the tag
+	std::string name;
+
+	// Tag of a struct that's also given a typedef name, which the struct can be found by too
+	std::string tag;
+
+	std::vector<StructMember> members;
+
+	cmpU32 size;
+	cmpU32 alignment;
+
+	// Why the layout couldn't be worked out, empty if it's known
+	std::string error;
+};
+
+
+typedef std::vector<StructLayout> StructLayouts;
+
+
+// Joins type tokens with spaces only where they separate words
+std::string GetTypeText(const std::vector<cmpToken*>& type_tokens);
+
+
+//
+// Gets the layout of a type on the processor's target from its tokens, treating pointers as 64-bit device
+// addresses. Struct types are looked up in the layouts given. Returns false if the layout isn't known.
+//
+bool GetTypeLayout(const std::vector<cmpToken*>& type_tokens, const ComputeProcessor& processor, const StructLayouts& structs, TypeLayout& layout);
+
+
+//
+// Lays out every named struct definition in the source in the order they're defined, following the C
+// rules of each target with the vector alignments described in cbpp/Math.h
+//
+void ComputeStructLayouts(ComputeProcessor& processor, StructLayouts& layouts);
+
+
+//
+// Writes a C++ header with a host struct mirroring the target layout of each struct, padded with
+// explicit bytes and checked with static_assert, so that they can be copied to the device as they are
+//
+void WriteStructLayoutHeader(const StructLayouts& layouts, const std::string& input_filename, ComputeTarget target, std::vector<char>& data);
+
+
+#endif
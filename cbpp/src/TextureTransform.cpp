@@ -1,7 +1,11 @@
 
 #include "ComputeProcessor.h"
+#include "KernelParamsWriter.h"
+#include "KernelReflection.h"
+#include "TextureTypes.h"
 
 #include <map>
+#include <unordered_map>
 #include <cassert>
 #include <string>
 #include <algorithm>
@@ -32,7 +36,6 @@ namespace
 	HashString KEYWORD_unsigned("unsigned");
 
 	// ComputeBridge macros
-	HashString KEYWORD_cmp_kernel_fn("cmp_kernel_fn");
 	HashString KEYWORD_cmp_texture_type("cmp_texture_type");
 	HashString KEYWORD_cmp_kernel_texture_decl("cmp_kernel_texture_decl");
 	HashString KEYWORD_cmp_kernel_texture_decl_comma("cmp_kernel_texture_decl_comma");
@@ -63,6 +66,109 @@ enum RefType
 };
 
 
+//
+// Perfect hash set of the texture/surface keywords, mapping each to its reference type.
+// The table size and shift are searched for on construction so that every keyword hash lands in its
+// own slot, making a lookup a single probe. Token matches can then be made with one pass over a
+// statement, whatever the number of keywords.
+//
+class RefKeywordSet
+{
+public:
+	RefKeywordSet()
+		: m_Shift(0)
+		, m_Mask(0)
+	{
+		const HashString* textures[] =
+		{
+			&KEYWORD_Texture3Dn, &KEYWORD_Texture3Du, &KEYWORD_Texture2Dn,
+			&KEYWORD_Texture2Du, &KEYWORD_Texture1Dn, &KEYWORD_Texture1Du,
+		};
+		const HashString* surfaces[] =
+		{
+			&KEYWORD_Surface3D, &KEYWORD_Surface2D, &KEYWORD_Surface1D,
+		};
+
+		std::vector<Slot> keywords;
+		for (size_t i = 0; i < sizeof(textures) / sizeof(textures[0]); i++)
+			keywords.push_back(Slot(textures[i]->hash, RefType_Texture));
+		for (size_t i = 0; i < sizeof(surfaces) / sizeof(surfaces[0]); i++)
+			keywords.push_back(Slot(surfaces[i]->hash, RefType_Surface));
+
+		// Grow the table from the smallest power of two that fits until a collision-free shift is found
+		for (cmpU32 size = 16; size <= 65536; size *= 2)
+		{
+			for (cmpU32 shift = 0; shift < 32; shift++)
+			{
+				if (Build(keywords, size, shift))
+					return;
+			}
+		}
+
+		// Only keywords with equal hashes can fail to fit
+		assert(false && "Texture keyword hashes collide");
+	}
+
+
+	RefType Find(cmpU32 hash) const
+	{
+		const Slot& slot = m_Slots[(hash >> m_Shift) & m_Mask];
+		return slot.hash == hash ? slot.type : RefType_None;
+	}
+
+
+	// Token predicate for TokenIterator
+	bool operator () (const cmpToken& token) const
+	{
+		return Find(token.hash) != RefType_None;
+	}
+
+
+private:
+	struct Slot
+	{
+		Slot(cmpU32 hash, RefType type)
+			: hash(hash)
+			, type(type)
+		{
+		}
+
+		cmpU32 hash;
+		RefType type;
+	};
+
+
+	bool Build(const std::vector<Slot>& keywords, cmpU32 size, cmpU32 shift)
+	{
+		m_Slots.assign(size, Slot(0, RefType_None));
+		m_Shift = shift;
+		m_Mask = size - 1;
+
+		for (size_t i = 0; i < keywords.size(); i++)
+		{
+			Slot& slot = m_Slots[(keywords[i].hash >> m_Shift) & m_Mask];
+			if (slot.type != RefType_None)
+				return false;
+			slot = keywords[i];
+		}
+
+		return true;
+	}
+
+
+	std::vector<Slot> m_Slots;
+	cmpU32 m_Shift;
+	cmpU32 m_Mask;
+};
+
+
+namespace
+{
+	// Built after the keywords above as they're in the same translation unit
+	const RefKeywordSet g_RefKeywords;
+}
+
+
 
 //
 // Reference to a texture type in the source file.
@@ -73,7 +179,6 @@ struct TextureRef
 	TextureRef()
 		: type(RefType_None)
 		, node(0)
-		, position(0)
 		, line(0)
 		, keyword_token(0)
 		, type_token(0)
@@ -110,11 +215,10 @@ struct TextureRef
 	// Pointer to the statement, typedef or function parameter list
 	cmpNode* node;
 
-	// Position/line the reference was found on
-	cmpU32 position;
+	// Line the reference was found on
 	cmpU32 line;
 
-	// Texture/surface keyword
+	// Texture/surface keyword, whose ordinal orders references in the source
 	cmpToken* keyword_token;
 
 	// Texel type keyword that may consist of two tokens, e.g. "unsigned int"
@@ -143,7 +247,7 @@ typedef std::vector<TextureRef> TextureRefs;
 //
 // A map from the hash a texture reference to all its found instances
 //
-typedef std::map<cmpU32, TextureRefs> TextureRefsMap;
+typedef std::unordered_map<cmpU32, TextureRefs> TextureRefsMap;
 
 
 //
@@ -156,19 +260,6 @@ public:
 		: m_TextureRefsMap(refs_map)
 		, m_LastError(cmpError_CreateOK())
 	{
-		m_TextureMatches = MatchHashes(
-			KEYWORD_Texture3Dn.hash,
-			KEYWORD_Texture3Du.hash,
-			KEYWORD_Texture2Dn.hash,
-			KEYWORD_Texture2Du.hash,
-			KEYWORD_Texture1Dn.hash,
-			KEYWORD_Texture1Du.hash);
-
-		m_SurfaceMatches = MatchHashes(
-			KEYWORD_Surface3D.hash,
-			KEYWORD_Surface2D.hash,
-			KEYWORD_Surface1D.hash);
-
 		m_TypeMatches = MatchHashes(
 			KEYWORD_char.hash,
 			KEYWORD_short.hash,
@@ -215,19 +306,16 @@ public:
 private:
 	bool ScanStatementForRefs(const char* filename, cmpNode& node, TokenIterator& iterator)
 	{
-		// Search for any of the texture keywords
-		if (iterator.SeekToken(m_TextureMatches))
-		{
+		// Search for the next texture or surface keyword, whichever comes first
+		cmpToken* token = iterator.SeekToken(g_RefKeywords);
+		if (token == 0)
+			return false;
+
+		if (g_RefKeywords.Find(token->hash) == RefType_Texture)
 			AddTextureRef(filename, node, iterator);
-			return true;
-		}
-		if (iterator.SeekToken(m_SurfaceMatches))
-		{
+		else
 			AddSurfaceRef(filename, node, iterator);
-			return true;
-		}
-
-		return false;
+		return true;
 	}
 
 
@@ -237,7 +325,6 @@ private:
 		TextureRef ref;
 		ref.type = RefType_Texture;
 		ref.node = &node;
-		ref.position = (cmpU32)iterator.token->start;
 		ref.line = iterator.token->line;
 		ref.keyword_token = iterator.token;
 		cmpU32 combined_hash = iterator.token->hash;
@@ -301,7 +388,6 @@ private:
 		TextureRef ref;
 		ref.type = RefType_Surface;
 		ref.node = &node;
-		ref.position = (cmpU32)iterator.token->start;
 		ref.line = iterator.token->line;
 		ref.keyword_token = iterator.token;
 		ref.end_of_type_token = iterator.token;
@@ -325,8 +411,6 @@ private:
 	}
 
 
-	MatchHashes m_TextureMatches;
-	MatchHashes m_SurfaceMatches;
 	MatchHashes m_TypeMatches;
 
 	TextureRefsMap& m_TextureRefsMap;
@@ -337,28 +421,6 @@ private:
 
 namespace
 {
-	const TextureRef& FindFirstTextureRef(const TextureRefs& refs)
-	{
-		const TextureRef* found_ref = 0;
-		cmpU32 first_line = UINT_MAX;
-
-		// Linear search through all texture refs looking for the one that occurs first
-		for (size_t i = 0; i < refs.size(); i++)
-		{
-			const TextureRef& ref = refs[i];
-			cmpU32 line = ref.line;
-			if (line < first_line)
-			{
-				found_ref = &ref;
-				first_line = line;
-			}
-		}
-
-		assert(found_ref != 0);
-		return *found_ref;
-	}
-
-
 	const HashString* GetDimensionsKeyword(cmpU32 dimensions)
 	{
 		const HashString* kw_dimensions = 0;
@@ -373,36 +435,6 @@ namespace
 	}
 
 
-	bool IsKernelFunction(cmpNode* node)
-	{
-		if (node->type != cmpNode_FunctionDefn && node->type != cmpNode_FunctionDecl)
-			return false;
-
-		TokenIterator ti(*node);
-		ti.SkipWhitespace();
-		if (ti.token == 0)
-			return false;
-
-		return ti.token->hash == KEYWORD_cmp_kernel_fn.hash;
-	}
-
-
-	std::string GetFunctionName(cmpNode* function_node)
-	{
-		assert(function_node->type == cmpNode_FunctionDefn || function_node->type == cmpNode_FunctionDecl);
-
-		// Walk backwards until the first symbol is found
-		cmpToken* function_name_token = function_node->last_token;
-		while (function_name_token != NULL && function_name_token->type != cmpToken_Symbol)
-			function_name_token = function_name_token->prev;
-
-		// Use the symbol token to construct the name
-		assert(function_name_token != NULL);
-		std::string function_name(function_name_token->start, function_name_token->length);
-		return function_name;
-	}
-
-
 	cmpNode* FindContainerParent(cmpNode* node)
 	{
 		// Typedefs are already a parent
@@ -422,42 +454,47 @@ namespace
 
 struct TextureGlobalVar
 {
-	// Which function/variable pair generated this global variable
-	std::string ref_name;
-	std::string function_name;
-
 	String global_name;
-
-	TokenList tokens;
 };
 
 
 class TextureType
 {
 public:
-	TextureType(cmpU32 texture_refs_key)
-		: m_TextureRefsKey(texture_refs_key)
+	TextureType(ComputeProcessor& processor, cmpU32 texture_refs_key)
+		: m_Processor(processor)
+		, m_TextureRefsKey(texture_refs_key)
+		, m_Dimensions(0)
+		, m_ReadType(0)
 	{
 	}
 
 
 	~TextureType()
 	{
-		// Responsibility for cleaning created tokens belongs with this object
+		// Type declarations left out of the output are still owned by this object
 		m_TypeDeclTokens.DeleteAll();
-		for (size_t i = 0; i < m_GlobalVars.size(); i++)
-			m_GlobalVars[i].tokens.DeleteAll();
 	}
 
 
-	void AddTypeDeclaration(const TextureRef& ref, int unique_index)
+	void AddTypeDeclaration(const TextureRef& ref, bool insert)
 	{
+		assert(ref.type == RefType_Texture || ref.type == RefType_Surface);
 		if (ref.type == RefType_Texture)
-			return AddTextureTypeDeclaration(ref, unique_index);
-		if (ref.type == RefType_Surface)
-			return AddSurfaceTypeDeclaration(ref, unique_index);
+			AddTextureTypeDeclaration(ref);
+		else
+			AddSurfaceTypeDeclaration(ref);
 
-		assert(false && "Invalid RefType");
+		// Keep the text for shared headers before the tokens are handed over to the processor
+		for (const cmpToken* token = m_TypeDeclTokens.first; token != 0; token = token->next)
+		{
+			m_DeclarationText.append(token->start, token->length);
+			if (token == m_TypeDeclTokens.last)
+				break;
+		}
+
+		if (insert)
+			AddNodeBeforeContainerParent(m_TypeDeclTokens, ref.node);
 	}
 
 
@@ -483,32 +520,23 @@ public:
 			return;
 		}
 
-		// Create the single replacement token
-		cmpToken* token;
-		cmpError error = cmpToken_Create(&token, cmpToken_Symbol, m_Name.text, m_Name.length, ref.line);
-		if (!cmpError_OK(&error))
-			throw error;
-
-		// Cut out the original tokens and replace with the new one
-		TokenList old_tokens(ref.keyword_token, ref.end_of_type_token);
-		token->prev = old_tokens.first->prev;
-		token->prev->next = token;
-		token->next = old_tokens.last->next;
-		token->next->prev = token;
-		old_tokens.DeleteAll();
+		// Replace the original tokens with the type name
+		TokenList tokens;
+		tokens.Add(cmpToken_Symbol, m_Name.text, m_Name.length, ref.line);
+		m_Processor.ReplaceTokens(ref.node, ref.keyword_token, ref.end_of_type_token, tokens);
 	}
 
 
-	const TextureGlobalVar* FindGlobal(const std::string& function_name, const std::string& param_name) const
+	const TextureGlobalVar* FindGlobal(const TextureRef& ref) const
 	{
-		for (size_t i = 0; i < m_GlobalVars.size(); i++)
-		{
-			const TextureGlobalVar& var = m_GlobalVars[i];
-			if (var.function_name == function_name && var.ref_name == param_name)
-				return &var;
-		}
+		GlobalVarMap::const_iterator i = m_GlobalVarMap.find(&ref);
+		return i != m_GlobalVarMap.end() ? &m_GlobalVars[i->second] : 0;
+	}
 
-		return 0;
+
+	const std::string& DeclarationText() const
+	{
+		return m_DeclarationText;
 	}
 
 
@@ -536,7 +564,7 @@ private:
 	TextureType& operator = (const TextureType&);
 
 
-	void AddTextureTypeDeclaration(const TextureRef& ref, int unique_index)
+	void AddTextureTypeDeclaration(const TextureRef& ref)
 	{
 		// Add cmp_texture_type(type, channels, read, name) macro call
 
@@ -546,16 +574,14 @@ private:
 		AddTexelTypeNameTokens(ref);
 		AddTextureDimensionsToken(ref);
 		AddReadTypeToken(ref);
-		AddUniqueNameToken(ref, unique_index, "Texture");
+		AddTypeNameToken(ref, "Texture");
 
 		m_TypeDeclTokens.Add(cmpToken_RBracket, ref.line);
 		m_TypeDeclTokens.Add(cmpToken_SemiColon, ref.line);
-
-		AddNodeBeforeContainerParent(m_TypeDeclTokens, ref.node);
 	}
 
 
-	void AddSurfaceTypeDeclaration(const TextureRef& ref, int unique_index)
+	void AddSurfaceTypeDeclaration(const TextureRef& ref)
 	{
 		// Add cmp_surface_type(channels, name) macro call
 
@@ -563,12 +589,10 @@ private:
 		m_TypeDeclTokens.Add(cmpToken_LBracket, ref.line);
 
 		AddTextureDimensionsToken(ref);
-		AddUniqueNameToken(ref, unique_index, "Surface");
+		AddTypeNameToken(ref, "Surface");
 
 		m_TypeDeclTokens.Add(cmpToken_RBracket, ref.line);
 		m_TypeDeclTokens.Add(cmpToken_SemiColon, ref.line);
-
-		AddNodeBeforeContainerParent(m_TypeDeclTokens, ref.node);
 	}
 
 
@@ -606,32 +630,30 @@ private:
 	}
 
 
-	void AddUniqueNameToken(const TextureRef& ref, int unique_index, const char* name)
+	void AddTypeNameToken(const TextureRef& ref, const char* name)
 	{
-		// Generate a unique type name and add as a symbol token
-		char type_name[64];
-		sprintf(type_name, "__%sTypeName_%d__", name, unique_index);
+		// Name the type after its dimensions, read type and texel type so that every file that uses it
+		// generates the same name, e.g. "__TextureTypeName_2Du_unsigned_int__"
+		std::string type_name = std::string("__") + name + "TypeName_";
+		type_name.append(ref.keyword_token->start + 7, ref.keyword_token->length - 7);
+		for (const cmpToken* token = ref.type_token; token != 0 && token != ref.last_type_token; token = token->next)
+		{
+			if (token->type == cmpToken_Symbol)
+				type_name += "_" + std::string(token->start, token->length);
+		}
+		type_name += "__";
 		m_Name = String(type_name);
 		m_TypeDeclTokens.Add(cmpToken_Symbol, m_Name.text, m_Name.length, ref.line);
 	}
 
 
-	void AddNodeBeforeContainerParent(const TokenList& tokens, cmpNode* child_node)
+	void AddNodeBeforeContainerParent(TokenList& tokens, cmpNode* child_node)
 	{
-		// Create the containing node (to be deleted by the parse tree)
-		cmpNode* node;
-		cmpError error = cmpNode_CreateEmpty(&node);
-		if (!cmpError_OK(&error))
-			throw error;
-		node->type = cmpNode_UserTokens;
-		node->first_token = tokens.first;
-		node->last_token = tokens.last;
-
 		// Add right before the containing parent
 		cmpNode* insert_before_node = FindContainerParent(child_node);
 		if (insert_before_node == NULL)
 			throw cmpError_Create("Failed to find a container parent for insertion");
-		cmpNode_AddBefore(insert_before_node, node);
+		m_Processor.InsertNodeBefore(insert_before_node, tokens);
 	}
 
 
@@ -679,14 +701,7 @@ private:
 		new_tokens.Add(cmpToken_RBracket, line);
 
 		// Replace the old tokens with the new ones
-		old_tokens.first->prev->next = new_tokens.first;
-		new_tokens.first->prev = old_tokens.first->prev;
-		old_tokens.last->next->prev = new_tokens.last;
-		new_tokens.last->next = old_tokens.last->next;
-
-		// As the new tokens are being placed in the main token list, they'll get cleaned up safely
-		// What remains is to clean the old tokens that were pulled out
-		old_tokens.DeleteAll();
+		m_Processor.ReplaceTokens(ref.node, old_tokens.first, old_tokens.last, new_tokens);
 	}
 
 
@@ -695,28 +710,28 @@ private:
 		TextureGlobalVar var;
 
 		// Start the token list
+		TokenList tokens;
 		cmpU32 line = function_node->first_token->line;
 		HashString keyword = (ref.type == RefType_Texture) ?
 			KEYWORD_cmp_kernel_texture_global_def : KEYWORD_cmp_kernel_surface_global_def;
-		var.tokens.Add(keyword, line);
-		var.tokens.Add(cmpToken_LBracket, line);
-		var.tokens.Add(cmpToken_Symbol, m_Name.text, m_Name.length, line);
-		var.tokens.Add(cmpToken_Comma, line);
+		tokens.Add(keyword, line);
+		tokens.Add(cmpToken_LBracket, line);
+		tokens.Add(cmpToken_Symbol, m_Name.text, m_Name.length, line);
+		tokens.Add(cmpToken_Comma, line);
 
 		// Finish off with a unique name for variable
 		std::string function_name = GetFunctionName(function_node);
 		char texture_var[64];
 		const char* name = (ref.type == RefType_Texture) ? "Texture" : "Surface";
 		sprintf(texture_var, "__%sVar_%s_%s__", name, function_name.c_str(), ref.name.text);
-		var.ref_name = ref.name.text;
-		var.function_name = function_name;
 		var.global_name = String(texture_var);
-		var.tokens.Add(cmpToken_Symbol, var.global_name.text, var.global_name.length, line);
-		var.tokens.Add(cmpToken_RBracket, line);
-		var.tokens.Add(cmpToken_SemiColon, line);
+		tokens.Add(cmpToken_Symbol, var.global_name.text, var.global_name.length, line);
+		tokens.Add(cmpToken_RBracket, line);
+		tokens.Add(cmpToken_SemiColon, line);
 
-		AddNodeBeforeContainerParent(var.tokens, ref.node);
+		AddNodeBeforeContainerParent(tokens, ref.node);
 
+		m_GlobalVarMap[&ref] = m_GlobalVars.size();
 		m_GlobalVars.push_back(var);
 	}
 
@@ -746,22 +761,22 @@ private:
 		tokens.Add(cmpToken_RBracket, line);
 		tokens.Add(cmpToken_SemiColon, line);
 
-		// Add to the end of the node's token list
-		// Initially, that last token should be the brace without any EOL info
-		block_node->last_token->next = tokens.first;
-		tokens.first->prev = block_node->last_token;
-		block_node->last_token = tokens.last;
+		// Add to the end of the node's token list, after the opening brace
+		m_Processor.AppendTokens(block_node, tokens);
 	}
 
 
+	ComputeProcessor& m_Processor;
+
 	// Key used to lookup texture refs that use this type
 	cmpU32 m_TextureRefsKey;
 
-	// Name of the uniquely generated string type
+	// Name of the generated type
 	String m_Name;
 
-	// Tokens created for the unique typedef
+	// Tokens created for the typedef, given to the processor unless it's left out of the output
 	TokenList m_TypeDeclTokens;
+	std::string m_DeclarationText;
 
 	// Raw type info
 	cmpU32 m_Dimensions;
@@ -769,23 +784,16 @@ private:
 
 	// List of global variables instantiated with this type
 	std::vector<TextureGlobalVar> m_GlobalVars;
-};
 
-
-static bool TextureRefPtrSort(const TextureRef* a, const TextureRef* b)
-{
-	return a->position < b->position;
-}
+	// Index of the global variable generated by each kernel parameter reference
+	typedef std::unordered_map<const TextureRef*, size_t> GlobalVarMap;
+	GlobalVarMap m_GlobalVarMap;
+};
 
 
 class TextureTransform : public ITransform
 {
 public:
-	TextureTransform()
-		: m_UniqueTypeIndex(0)
-	{
-	}
-
 	~TextureTransform()
 	{
 		for (size_t i = 0; i < m_TextureTypes.size(); i++)
@@ -798,13 +806,22 @@ private:
 		if (cmpError error = FindAllTextureRefs(processor))
 			return error;
 
-		if (cmpError error = AddTypeDeclarations())
+		// Types declared in a shared header are left out of the output
+		std::string output_texture_types = processor.TargetProperty("-output_texture_types");
+		if (cmpError error = AddTypeDeclarations(processor, output_texture_types == ""))
 			return error;
 
+		// Parameters have to be recorded before their types are replaced
+		if (processor.TargetProperty("-output_bin") != "" || processor.TargetProperty("-output_header") != "")
+			ReflectKernels(processor, m_Kernels);
+
 		if (cmpError error = TransformAST())
 			return error;
 
-		if (cmpError error = WriteBinary(processor))
+		if (cmpError error = WriteKernelParams(processor))
+			return error;
+
+		if (cmpError error = WriteTextureTypes(output_texture_types))
 			return error;
 
 		return cmpError_CreateOK();
@@ -824,21 +841,28 @@ private:
 	}
 
 
-	cmpError AddTypeDeclarations()
+	cmpError AddTypeDeclarations(ComputeProcessor& processor, bool insert)
 	{
-		// Build a list of all unique texture types introduced
+		// Visit types in key order so that the generated names don't depend on the hash table layout
+		std::vector<cmpU32> type_keys;
 		for (TextureRefsMap::const_iterator i = m_TextureRefsMap.begin(); i != m_TextureRefsMap.end(); ++i)
+			type_keys.push_back(i->first);
+		std::sort(type_keys.begin(), type_keys.end());
+
+		// Build a list of all unique texture types introduced
+		for (size_t i = 0; i < type_keys.size(); i++)
 		{
-			const TextureRefs& refs = i->second;
+			const TextureRefs& refs = m_TextureRefsMap.find(type_keys[i])->second;
 
-			// Generate a texture type from the first instance of this texture reference
-			const TextureRef& first_ref = FindFirstTextureRef(refs);
-			TextureType* texture_type = new TextureType(i->first);
+			// Generate a texture type from the first instance of this texture reference, with references
+			// recorded in the order they appear in the source
+			const TextureRef& first_ref = refs.front();
+			TextureType* texture_type = new TextureType(processor, type_keys[i]);
 
 			// Place a type declaration somewhere before the first node
 			try
 			{
-				texture_type->AddTypeDeclaration(first_ref, m_UniqueTypeIndex++);
+				texture_type->AddTypeDeclaration(first_ref, insert);
 			}
 			catch (const cmpError& error)
 			{
@@ -847,6 +871,7 @@ private:
 			}
 
 			m_TextureTypes.push_back(texture_type);
+			m_TextureTypeMap[type_keys[i]] = texture_type;
 		}
 
 		return cmpError_CreateOK();
@@ -878,19 +903,23 @@ private:
 	}
 
 
-	cmpError WriteBinary(const ComputeProcessor& processor)
+	cmpError WriteKernelParams(const ComputeProcessor& processor)
 	{
-		// The absence of an output binary filename is not an error
-		std::string output_bin = processor.Arguments().GetProperty("-output_bin");
-		if (output_bin == "")
+		// The absence of output binary/header filenames is not an error
+		std::string output_bin = processor.TargetProperty("-output_bin");
+		std::string output_header = processor.TargetProperty("-output_header");
+		if (output_bin == "" && output_header == "")
 			return cmpError_CreateOK();
 
-		typedef std::vector<const TextureRef*> TextureRefPtrs;
-		typedef std::map<std::string, TextureRefPtrs> TextureRefPtrsMap;
-		TextureRefPtrsMap ref_ptrs_map;
+		typedef std::map<std::pair<std::string, std::string>, std::string> GlobalNameMap;
+		GlobalNameMap global_names;
+
+		// OpenCL textures and surfaces are bound as image arguments, with the global definitions expanding
+		// to nothing, so there are only globals to name on CUDA
+		bool have_globals = processor.Target() != ComputeTarget_OpenCL;
 
 		// Iterate over all texture references
-		for (TextureRefsMap::const_iterator i = m_TextureRefsMap.begin(); i != m_TextureRefsMap.end(); ++i)
+		for (TextureRefsMap::const_iterator i = m_TextureRefsMap.begin(); have_globals && i != m_TextureRefsMap.end(); ++i)
 		{
 			const TextureRefs& refs = i->second;
 			for (size_t j = 0; j < refs.size(); j++)
@@ -898,7 +927,7 @@ private:
 				const TextureRef& ref = refs[j];
 
 				// Looking for function parameters
-				if (ref.node->type != cmpNode_FunctionParams)
+				if (ref.node->type != cmpNode_FunctionParams || ref.name.text == 0)
 					continue;
 
 				// The function must be a kernel function definition (declarations are prototypes)
@@ -906,96 +935,88 @@ private:
 				if (function_node->type != cmpNode_FunctionDefn || !IsKernelFunction(function_node))
 					continue;
 
-				// Group texture refs by function
-				std::string function_name = GetFunctionName(function_node);
-				ref_ptrs_map[function_name].push_back(&ref);
-			}
-		}
-
-		// Sort all references by their position in the parameter list (implied from file position)
-		for (TextureRefPtrsMap::iterator i = ref_ptrs_map.begin(); i != ref_ptrs_map.end(); ++i)
-		{
-			TextureRefPtrs& ptrs = i->second;
-			std::sort(ptrs.begin(), ptrs.end(), TextureRefPtrSort);
-		}
-
-		// Open the output file
-		FILE* fp = fopen(output_bin.c_str(), "wb");
-		if (fp == NULL)
-			return cmpError_Create("Failed to write to output binary file '%s'", output_bin.c_str());
-
-		// Write the header
-		char ID[] = "CUDAKernelTextureParams";
-		fwrite(ID, 1, sizeof(ID) - 1, fp);
-		cmpU32 nb_functions = ref_ptrs_map.size();
-		fwrite(&nb_functions, 1, sizeof(nb_functions), fp);
-
-		// Iterate over every function's list of texture references
-		for (TextureRefPtrsMap::const_iterator i = ref_ptrs_map.begin(); i != ref_ptrs_map.end(); ++i)
-		{
-			// Write the function name
-			std::string function_name = i->first;
-			size_t function_name_size = function_name.length();
-			fwrite(&function_name_size, 1, sizeof(function_name_size), fp);
-			fwrite(function_name.c_str(), 1, function_name_size, fp);
-
-			// Write the number of texture parameters in the function
-			const TextureRefPtrs& ptrs = i->second;
-			size_t nb_ptrs = ptrs.size();
-			fwrite(&nb_ptrs, 1, sizeof(nb_ptrs), fp);
-
-			for (size_t j = 0; j < nb_ptrs; j++)
-			{
-				const TextureRef& ref = *ptrs[j];
-
-				// Map the texture reference to its type
+				// Map the texture reference to the global variable it generated
 				const TextureType* type = FindTextureType(ref.type_key);
 				if (type == 0)
 					continue;
-
-				// Map the texture reference to the global variable it generated
-				const TextureGlobalVar* var = type->FindGlobal(function_name, ref.name.text);
+				const TextureGlobalVar* var = type->FindGlobal(ref);
 				if (var == 0)
 					continue;
 
-				// Write global variable name
-				fwrite(&var->global_name.length, 1, sizeof(var->global_name.length), fp);
-				fwrite(var->global_name.text, 1, var->global_name.length, fp);
+				global_names[std::make_pair(GetFunctionName(function_node), std::string(ref.name.text))] = var->global_name.text;
+			}
+		}
 
-				// Write type info
-				fwrite(&ref.type, 1, 1, fp);
-				cmpU32 dimensions = type->Dimensions();
-				fwrite(&dimensions, 1, sizeof(dimensions), fp);
-				char read_type = type->ReadType();
-				fwrite(&read_type, 1, 1, fp);
+		// Attach the globals to the reflected parameters they were generated for
+		KernelParamsWriter writer(processor.Target());
+		for (size_t i = 0; i < m_Kernels.size(); i++)
+		{
+			KernelInfo& kernel = m_Kernels[i];
+			for (size_t j = 0; j < kernel.params.size(); j++)
+			{
+				KernelParam& param = kernel.params[j];
+				GlobalNameMap::const_iterator global_name = global_names.find(std::make_pair(kernel.name, param.name));
+				if (global_name != global_names.end())
+					param.global_name = global_name->second;
 			}
+
+			writer.AddKernel(kernel);
 		}
 
-		fclose(fp);
+		// Leave the files untouched if nothing has changed
+		std::vector<char> data;
+		if (output_bin != "")
+		{
+			writer.Write(data);
+			if (!WriteFileIfChanged(output_bin, data))
+				return cmpError_Create("Failed to write to output binary file '%s'", output_bin.c_str());
+		}
+		if (output_header != "")
+		{
+			writer.WriteHeader(data, processor.InputFilename(), ComputeTargetName(processor.Target()));
+			if (!WriteFileIfChanged(output_header, data))
+				return cmpError_Create("Failed to write to output header file '%s'", output_header.c_str());
+		}
 
 		return cmpError_CreateOK();
 	}
 
 
-	const TextureType* FindTextureType(cmpU32 type_key) const
+	cmpError WriteTextureTypes(const std::string& output_texture_types)
 	{
+		if (output_texture_types == "")
+			return cmpError_CreateOK();
+
+		// Add the types declared by this file to those already in the header
+		std::vector<std::string> declarations;
 		for (size_t i = 0; i < m_TextureTypes.size(); i++)
-		{
-			const TextureType* type = m_TextureTypes[i];
-			if (type->TextureRefsKey() == type_key)
-				return type;
-		}
+			declarations.push_back(m_TextureTypes[i]->DeclarationText());
+		std::vector<char> data;
+		WriteTextureTypesHeader(declarations, data);
+		if (!MergeTextureTypesHeader(output_texture_types, data))
+			return cmpError_Create("Failed to write to output texture types file '%s'", output_texture_types.c_str());
 
-		return 0;
+		return cmpError_CreateOK();
 	}
 
 
-	// Used to generate unique type names for texture references
-	int m_UniqueTypeIndex;
+	const TextureType* FindTextureType(cmpU32 type_key) const
+	{
+		TextureTypeMap::const_iterator i = m_TextureTypeMap.find(type_key);
+		return i != m_TextureTypeMap.end() ? i->second : 0;
+	}
+
 
 	TextureRefsMap m_TextureRefsMap;
 
 	std::vector<TextureType*> m_TextureTypes;
+
+	// Parameters of every kernel, only recorded when they're written out
+	std::vector<KernelInfo> m_Kernels;
+
+	// Hashed index of the texture types, owned by m_TextureTypes
+	typedef std::unordered_map<cmpU32, TextureType*> TextureTypeMap;
+	TextureTypeMap m_TextureTypeMap;
 };
 
 
@@ -0,0 +1,91 @@
+
+#include "TextureTypes.h"
+#include "Base.h"
+
+#include <map>
+
+
+namespace
+{
+	// Declarations indexed by the name of the type they declare
+	typedef std::map<std::string, std::string> Declarations;
+
+
+	void AddDeclaration(const std::string& declaration, Declarations& declarations)
+	{
+		// The type name is the last macro argument
+		size_t end = declaration.rfind(')');
+		if (end == std::string::npos)
+			return;
+		size_t start = declaration.rfind(',', end);
+		if (start == std::string::npos)
+			return;
+
+		declarations[declaration.substr(start + 1, end - start - 1)] = declaration;
+	}
+
+
+	void ParseDeclarations(const std::vector<char>& data, Declarations& declarations)
+	{
+		// Only the declarations are needed, the guards around them get written again
+		std::string line;
+		for (size_t i = 0; i <= data.size(); i++)
+		{
+			if (i == data.size() || data[i] == '\n')
+			{
+				if (line.compare(0, 17, "cmp_texture_type(") == 0 || line.compare(0, 17, "cmp_surface_type(") == 0)
+					AddDeclaration(line, declarations);
+				line.clear();
+			}
+			else if (data[i] != '\r')
+			{
+				line += data[i];
+			}
+		}
+	}
+
+
+	void WriteDeclarations(const Declarations& declarations, std::vector<char>& data)
+	{
+		std::string text;
+		text += "// Texture and surface types shared by cbpp generated files\n";
+		for (Declarations::const_iterator i = declarations.begin(); i != declarations.end(); ++i)
+		{
+			text += "\n";
+			text += "#ifndef CBPP_DEFINED" + i->first + "\n";
+			text += "#define CBPP_DEFINED" + i->first + "\n";
+			text += i->second + "\n";
+			text += "#endif\n";
+		}
+
+		data.assign(text.begin(), text.end());
+	}
+}
+
+
+void WriteTextureTypesHeader(const std::vector<std::string>& declarations, std::vector<char>& data)
+{
+	Declarations sorted;
+	for (size_t i = 0; i < declarations.size(); i++)
+		AddDeclaration(declarations[i], sorted);
+	WriteDeclarations(sorted, data);
+}
+
+
+bool MergeTextureTypesHeader(const std::string& filename, const std::vector<char>& data)
+{
+	// Runs sharing the header take turns so that none replaces it between another's read and write,
+	// losing what that run added
+	FileLock lock;
+	if (!Lock(lock, filename + ".lock"))
+		return false;
+
+	Declarations declarations;
+	std::vector<char> file_data;
+	if (LoadFileData(filename.c_str(), file_data))
+		ParseDeclarations(file_data, declarations);
+
+	ParseDeclarations(data, declarations);
+	WriteDeclarations(declarations, file_data);
+	return WriteFileIfChanged(filename, file_data);
+}
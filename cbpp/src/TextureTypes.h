@@ -0,0 +1,26 @@
+
+#ifndef INCLUDED_TEXTURE_TYPES_H
+#define INCLUDED_TEXTURE_TYPES_H
+
+
+#include <string>
+#include <vector>
+
+
+//
+// Writes a header of cmp_texture_type/cmp_surface_type declarations, sorted by type name. Each is
+// guarded so that it's only defined once, however many generated files include it.
+//
+void WriteTextureTypesHeader(const std::vector<std::string>& declarations, std::vector<char>& data);
+
+
+//
+// Adds the declarations of a header written above to those already in the file, so that runs over
+// different source files can share the one header. Types are named after what they are, making any
+// declarations with the same name identical. Runs updating the same header take turns through a lock
+// on the file of the same name with ".lock" appended, which is left alongside it.
+//
+bool MergeTextureTypesHeader(const std::string& filename, const std::vector<char>& data);
+
+
+#endif
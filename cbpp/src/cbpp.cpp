@@ -16,10 +16,21 @@
 
 #include "Base.h"
 #include "ComputeProcessor.h"
+#include "IncludeCache.h"
+#include "OutputCache.h"
+#include "PrecompiledHeader.h"
+#include "Server.h"
+#include "SourceMap.h"
+#include "TextureTypes.h"
 #include "fcpp.h"
 
 #include <string>
 #include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <map>
+#include <mutex>
 
 #include "../../lib/ComputeParser.h"
 
@@ -32,16 +43,21 @@
 #endif
 
 
+// Changes to this invalidate all cached output
+#define CBPP_VERSION "1.5"
+
+
 void PrintHeader()
 {
-	printf("cbpp Compute Bridge Preprocessor Copyright 2014 Celtoys Ltd\n");
+	printf("cbpp Compute Bridge Preprocessor v%s Copyright 2014 Celtoys Ltd\n", CBPP_VERSION);
 	printf("Licensed under the Apache License, Version 2.0 \n");
 }
 
 
 void PrintUsage()
 {
-	printf("Usage: cbpp filename -target <cuda|opencl> [options]\n");
+	printf("Usage: cbpp filename -target <cuda|opencl>[,...] [options]\n");
+	printf("       cbpp --server <socket>\n");
 }
 
 
@@ -52,90 +68,272 @@ void PrintHelp()
 	printf("   -noheader          Supress header\n");
 	printf("   -verbose           Print logs detailing what cbpp is doing behind the scenes\n");
 	printf("   -output <path>     Generated file output path\n");
+	printf("   -output_bin <path> Kernel parameter binary output path\n");
+	printf("   -output_map <path> Binary source map output path, locating generated code in the original files\n");
+	printf("   -output_header <path> C++ header output path, with constexpr tables of kernel parameters\n");
+	printf("   -output_structs <path> C++ header output path, with host structs matching the target's struct layouts\n");
+	printf("   -output_texture_types <path> Header the texture/surface types are declared in instead of the output,\n");
+	printf("                      added to by every run that shares it\n");
+	printf("   -line_directives   Emit #line directives that locate generated code in the original files\n");
+	printf("   -cuda_long_size <4|8> Size of long/ulong in the CUDA host code, default is %u as on this platform\n", (cmpU32)sizeof(long));
 	printf("   -i <path>          Specify additional include search path\n");
 	printf("   -d <sym|sym=val>   Define macro symbols\n");
 	printf("   -show_includes     Print the included files to stdout\n");
+	printf("   -pch <path>        Preprocess a header ahead of the input, reusing a snapshot of the result\n");
+	printf("   -cache_dir <path>  Reuse output previously generated from the same input, includes and options\n");
+	printf("   -cache_size <mb>   Maximum size of the cache directory, default is 256mb\n");
+	printf("   -MD                Write a Makefile dependency file next to the output, named <output>.d\n");
+	printf("   -MF <path>         Write a Makefile dependency file to the given path\n");
+	printf("   -connect <socket>  Send the command-line to a cbpp server started with --server\n");
+	printf("\nSnapshots made by -pch are kept in the cache directory when -cache_dir is given.\n");
+	printf("\nMultiple targets can be emitted from one run by listing them, comma-separated, after\n");
+	printf("-target. The -output, -output_bin, -output_map, -output_header, -output_structs and\n");
+	printf("-output_texture_types paths are then comma-separated lists in the same order.\n");
 }
 
 
 struct EmitFile : public INodeVisitor
 {
-	EmitFile(const char* filename)
-		: last_error(cmpError_CreateOK())
+	EmitFile(SourceMap* source_map, bool line_directives)
+		: source_map(source_map)
+		, line_directives(line_directives)
+		, line_start(0)
+		, line_blank(true)
+		, have_location(false)
+		, file_index(0)
+		, line(0)
 	{
-		if (!Open(file, filename, "wb"))
-			last_error = cmpError_Create("Couldn't open file '%s' for writing", filename);
 	}
 
-	bool Visit(const ComputeProcessor&, cmpNode& node)
+	bool Visit(const ComputeProcessor& processor, cmpNode& node)
 	{
-		if (file.fp == 0)
-			return false;
+		// Directives from the preprocessor are replaced with ones that account for the transforms
+		if (line_directives && IsLineDirective(node))
+			return true;
 
 		for (TokenIterator i(node); i; ++i)
 		{
 			const cmpToken& token = *i.token;
-			fprintf(file.fp, "%.*s", token.length, token.start);
+			if (source_map != 0 && token.type != cmpToken_Whitespace && token.type != cmpToken_EOL)
+				MapToken(token, processor.IsInputToken(token));
+			else if (token.type == cmpToken_EOL)
+				EndLine();
+			data.insert(data.end(), token.start, token.start + token.length);
+
+			if (source_map != 0)
+				CountLines(token);
 		}
 
 		return true;
 	}
 
-	File file;
+	static bool IsLineDirective(const cmpNode& node)
+	{
+		if (node.type != cmpNode_PPDirective)
+			return false;
+
+		const cmpToken* token = node.first_token->next;
+		while (token != 0 && token != node.last_token && token->type == cmpToken_Whitespace)
+			token = token->next;
+		return token != 0 && token->length == 4 && !strncmp(token->start, "line", 4);
+	}
+
+	void MapToken(const cmpToken& token, bool input_token)
+	{
+		cmpU32 token_file_index, token_line;
+		if (!source_map->Locate(token.line, token_file_index, token_line))
+			return;
+
+		if (line_blank)
+		{
+			// Tokens made by the transforms borrow the line of nearby code, so a line is located by the
+			// first token on it from the input, if it has one. The map and any #line directive agree.
+			if (!input_token)
+			{
+				PendingEntry entry = { data.size(), token_file_index, token_line };
+				pending_entries.push_back(entry);
+				return;
+			}
+			LocateLine(token_file_index, token_line);
+		}
+
+		source_map->AddEntry((cmpU32)data.size(), token_file_index, token_line);
+	}
+
+	void LocateLine(cmpU32 line_file_index, cmpU32 line_line)
+	{
+		// Correct the compiler's idea of where it is before the first token on a line
+		size_t directive_length = 0;
+		if (line_directives && (!have_location || line_file_index != file_index || line_line != line))
+		{
+			char directive[32];
+			sprintf(directive, "#line %u \"", line_line);
+			std::string text = directive + source_map->Filename(line_file_index) + "\"\n";
+			data.insert(data.begin() + line_start, text.begin(), text.end());
+			line_start += text.length();
+			directive_length = text.length();
+
+			have_location = true;
+			file_index = line_file_index;
+			line = line_line;
+		}
 
-	cmpError last_error;
+		line_blank = false;
+
+		// Map the tokens held back until now to the line they're on, after any directive moved them along
+		for (size_t i = 0; i < pending_entries.size(); i++)
+			source_map->AddEntry((cmpU32)(pending_entries[i].offset + directive_length), line_file_index, line_line);
+		pending_entries.clear();
+	}
+
+	void EndLine()
+	{
+		// Lines with nothing from the input are located by their first token
+		if (!pending_entries.empty())
+			LocateLine(pending_entries[0].file_index, pending_entries[0].line);
+	}
+
+	void CountLines(const cmpToken& token)
+	{
+		size_t offset = data.size() - token.length;
+		for (cmpU32 i = 0; i < token.length; i++)
+		{
+			if (token.start[i] == '\n')
+			{
+				line_start = offset + i + 1;
+				line_blank = true;
+				line++;
+			}
+		}
+	}
+
+	// Optional map of output offsets to original locations
+	SourceMap* source_map;
+
+	// Emit #line directives wherever the output doesn't follow on from the line before
+	bool line_directives;
+
+	// Offset of the current output line and whether anything other than whitespace is on it
+	size_t line_start;
+	bool line_blank;
+
+	// Where the compiler thinks the current output line comes from
+	bool have_location;
+	cmpU32 file_index;
+	cmpU32 line;
+
+	// Tokens at the start of the current line waiting for it to be located
+	struct PendingEntry
+	{
+		size_t offset;
+		cmpU32 file_index;
+		cmpU32 line;
+	};
+	std::vector<PendingEntry> pending_entries;
+
+	// Generated in memory so that an unchanged output file can be left alone
+	std::vector<char> data;
 };
 
 
+// Include files read by every preprocessing run made by this process
+IncludeCache g_IncludeCache;
+
+
+// Precompiled header snapshots made or loaded by this process, indexed by PrecompiledHeaderKey
+std::map<cmpU64, std::shared_ptr<const PrecompiledHeader> > g_PrecompiledHeaders;
+std::mutex g_PrecompiledHeadersMutex;
+
+
 struct PPInfo
 {
-	PPInfo(const std::vector<char>& in_data)
-		: in_data(in_data)
-		, read_pos(0)
+	PPInfo()
+		: pch(0)
+		, output_start(0)
 	{
 	}
 
-	const std::vector<char>& in_data;
-	size_t read_pos;
-
 	std::vector<char> out_data;
+
+	// Every file included by the input, without duplicates
+	std::vector<std::string> included_files;
+
+	// Keeps include file contents alive while fcpp reads them
+	std::vector<IncludeCache::FileData> open_files;
+
+	// Include directories checked for changes during this run
+	IncludeCache::DirectoryTimes directory_times;
+
+	// Receives the final macros and guarded files when building a precompiled header
+	PrecompiledHeader* pch;
+
+	// Names and strings in the output, located by their offset in out_data
+	std::vector<TokenSpan> token_spans;
+
+	// Where the output of the current fcpp run starts in out_data
+	size_t output_start;
 };
 
 
-char* PPInput(char* buffer, int size, void* user_data)
+void PPOutputBlock(char* data, int size, void* user_data)
 {
 	PPInfo& pp_info(*(PPInfo*)user_data);
+	pp_info.out_data.insert(pp_info.out_data.end(), data, data + size);
+}
 
-	// Read until EOF/EOL or not enough output bytes left
-	int write_pos = 0;
-	while (write_pos < size - 1)
-	{
-		// Check for EOF
-		if (pp_info.read_pos >= pp_info.in_data.size())
-			return NULL;
 
-		char c = pp_info.in_data[pp_info.read_pos++];
+void PPOutputToken(int type, size_t start, size_t length, void* user_data)
+{
+	PPInfo& pp_info(*(PPInfo*)user_data);
 
-		// Don't add CR to the buffer as fcpp doesn't recognise that as white-space and will error
-		// All characters other than that go into the buffer (including EOL)
-		if (c != '\r')
-			buffer[write_pos++] = c;
+	// Numbers are left to the lexer as its rules for them differ from fcpp's
+	enum cmpTokenType token_type;
+	if (type == FPP_TOKEN_NAME)
+		token_type = cmpToken_Symbol;
+	else if (type == FPP_TOKEN_STRING)
+		token_type = cmpToken_String;
+	else
+		return;
 
-		if (c == '\n')
-			break;
-	}
+	start += pp_info.output_start;
+	pp_info.token_spans.push_back(TokenSpan(token_type, (cmpU32)start, (cmpU32)length));
+}
 
-	// NULL terminate
-	buffer[write_pos] = 0;
 
-	return buffer;
+char* PPOpenFile(char* filename, size_t* size, void* user_data)
+{
+	PPInfo& pp_info(*(PPInfo*)user_data);
+
+	IncludeCache::FileData data = g_IncludeCache.Load(filename, pp_info.directory_times);
+	if (!data)
+		return 0;
+	pp_info.open_files.push_back(data);
+
+	*size = data->size();
+	return data->empty() ? (char*)"" : (char*)data->data();
 }
 
 
-void PPOutput(int c, void* user_data)
+void PPDepends(char* filename, void* user_data)
 {
 	PPInfo& pp_info(*(PPInfo*)user_data);
-	pp_info.out_data.push_back(c);
+	std::vector<std::string>& files = pp_info.included_files;
+	if (std::find(files.begin(), files.end(), filename) == files.end())
+		files.push_back(filename);
+}
+
+
+void PPDumpMacro(fppMacro* macro, void* user_data)
+{
+	PPInfo& pp_info(*(PPInfo*)user_data);
+	pp_info.pch->AddMacro(*macro);
+}
+
+
+void PPDumpGuard(fppGuard* guard, void* user_data)
+{
+	PPInfo& pp_info(*(PPInfo*)user_data);
+	pp_info.pch->AddGuard(*guard);
 }
 
 
@@ -158,30 +356,42 @@ std::string FormatPath(std::string path)
 }
 
 
-std::vector<char> PreProcessFile(const Arguments& args, std::string filename, const std::vector<char>& in_data, ComputeTarget target)
+bool RunPreProcessor(const Arguments& args, std::string filename, const std::vector<char>& in_data, ComputeTarget target, const PrecompiledHeader* start_pch, PPInfo& pp_info)
 {
 	fppTag tags[200];
 	fppTag* tagptr = tags;
 
-	// Create/set the user data
-	PPInfo pp_info(in_data);
+	// Set the user data
+	pp_info.out_data.reserve(pp_info.out_data.size() + in_data.size() * 2);
 	tagptr->tag = FPPTAG_USERDATA;
 	tagptr->data = &pp_info;
 	tagptr++;
 
-	// Set the input function
-	tagptr->tag = FPPTAG_INPUT;
-	tagptr->data = PPInput;
+	// fcpp reads lines straight out of the loaded input file, stripping CR as it goes
+	tagptr->tag = FPPTAG_INPUT_BUFFER;
+	tagptr->data = (void*)(in_data.empty() ? "" : in_data.data());
+	tagptr++;
+	tagptr->tag = FPPTAG_INPUT_BUFFER_SIZE;
+	tagptr->data = (void*)in_data.size();
 	tagptr++;
 
-	// Set the output function
-	tagptr->tag = FPPTAG_OUTPUT;
-	tagptr->data = PPOutput;
+	// Receive output in blocks rather than a character at a time
+	tagptr->tag = FPPTAG_OUTPUT_BLOCK;
+	tagptr->data = (void*)PPOutputBlock;
 	tagptr++;
 
+	// Have fcpp point out the names and strings it has already read so that they needn't be lexed again
+	if (pp_info.pch == 0)
+	{
+		pp_info.output_start = pp_info.out_data.size();
+		tagptr->tag = FPPTAG_OUTPUT_TOKEN;
+		tagptr->data = (void*)PPOutputToken;
+		tagptr++;
+	}
+
 	// Set the error function
 	tagptr->tag = FPPTAG_ERROR;
-	tagptr->data = PPError;
+	tagptr->data = (void*)PPError;
 	tagptr++;
 
 	// Don't display version information
@@ -201,13 +411,18 @@ std::vector<char> PreProcessFile(const Arguments& args, std::string filename, co
 	tagptr->data = (void*)TRUE;
 	tagptr++;
 
+	// Read include files through the cache
+	tagptr->tag = FPPTAG_OPENFILE;
+	tagptr->data = (void*)PPOpenFile;
+	tagptr++;
+
+	// Record include files as they're opened
+	tagptr->tag = FPPTAG_DEPENDS;
+	tagptr->data = (void*)PPDepends;
+	tagptr++;
+
 	// Promote the input filename to an absolute path so that relative paths can provide an include directory
-	if (!IsPathAbsolute(filename))
-	{
-		std::string cwd = GetCurrentWorkingDirectory();
-		filename = JoinPaths(cwd, filename);
-		std::replace(filename.begin(), filename.end(), '\\', '/');
-	}
+	filename = GetAbsolutePath(filename);
 
 	// Set the input filename
 	tagptr->tag = FPPTAG_INPUT_NAME;
@@ -271,6 +486,33 @@ std::vector<char> PreProcessFile(const Arguments& args, std::string filename, co
 		tagptr++;
 	}
 
+	// Start from the macros and guarded files left by a precompiled header
+	std::vector<fppMacro> macros;
+	std::vector<fppGuard> guards;
+	if (start_pch != 0)
+	{
+		start_pch->GetFppMacros(macros);
+		tagptr->tag = FPPTAG_MACROS;
+		tagptr->data = (void*)macros.data();
+		tagptr++;
+
+		start_pch->GetFppGuards(guards);
+		tagptr->tag = FPPTAG_GUARDS;
+		tagptr->data = (void*)guards.data();
+		tagptr++;
+	}
+
+	// Capture the state left at the end when building a precompiled header
+	if (pp_info.pch != 0)
+	{
+		tagptr->tag = FPPTAG_DUMPMACROS;
+		tagptr->data = (void*)PPDumpMacro;
+		tagptr++;
+		tagptr->tag = FPPTAG_DUMPGUARDS;
+		tagptr->data = (void*)PPDumpGuard;
+		tagptr++;
+	}
+
 	// Optionally show include dependencies
 	if (args.Have("-show_includes"))
 	{
@@ -284,13 +526,369 @@ std::vector<char> PreProcessFile(const Arguments& args, std::string filename, co
 	tagptr->data = 0;
 	tagptr++;	
 
-	fppPreProcess(tags);
+	return fppPreProcess(tags) == 0;
+}
+
 
-	return pp_info.out_data;
+cmpU64 HashPreProcessArgs(const Arguments& args, ComputeTarget target, cmpU64 key)
+{
+	key = Hash64String(ComputeTargetName(target), key);
+
+	// Relative include directories are searched from the current directory
+	key = Hash64String(GetCurrentWorkingDirectory(), key);
+	for (size_t i = 2; i + 1 < args.Count(); i++)
+	{
+		if (args[i] == "-i" || args[i] == "-d" || args[i] == "-pch")
+		{
+			key = Hash64String(args[i], key);
+			key = Hash64String(args[i + 1], key);
+		}
+	}
+
+	return key;
 }
 
 
-int main(int argc, const char* argv[])
+cmpU64 PrecompiledHeaderKey(const Arguments& args, const std::string& header, ComputeTarget target)
+{
+	cmpU64 key = Hash64String(CBPP_VERSION);
+	key = Hash64String(args[0], key);
+	key = Hash64String(header, key);
+	return HashPreProcessArgs(args, target, key);
+}
+
+
+void DropUnusedLineDirective(std::vector<char>& text)
+{
+	// fcpp starts its output by locating the header, which is left with nothing to locate when the
+	// header only defines macros or includes other files that are located themselves
+	const char directive[] = "#line ";
+	size_t length = sizeof(directive) - 1;
+	if (text.size() < length || memcmp(text.data(), directive, length) != 0)
+		return;
+
+	std::vector<char>::iterator end = std::find(text.begin(), text.end(), '\n');
+	if (end != text.end())
+		end++;
+	size_t rest = text.end() - end;
+	if (rest == 0 || (rest >= length && memcmp(&*end, directive, length) == 0))
+		text.erase(text.begin(), end);
+}
+
+
+std::shared_ptr<const PrecompiledHeader> GetPrecompiledHeader(const Arguments& args, ComputeTarget target)
+{
+	std::string header = GetAbsolutePath(args.GetProperty("-pch"));
+	cmpU64 key = PrecompiledHeaderKey(args, header, target);
+
+	// Held throughout so that concurrent runs build each snapshot only once
+	std::lock_guard<std::mutex> lock(g_PrecompiledHeadersMutex);
+
+	// Reuse a snapshot already made by this process if none of its files have changed
+	std::shared_ptr<const PrecompiledHeader>& pch = g_PrecompiledHeaders[key];
+	if (pch && pch->IsUpToDate())
+		return pch;
+	pch.reset();
+
+	// Next try one stored by a previous run
+	std::string pch_path;
+	std::string cache_dir = args.GetProperty("-cache_dir");
+	if (!cache_dir.empty())
+	{
+		char filename[64];
+		sprintf(filename, "%016llx.pch", key);
+		pch_path = JoinPaths(cache_dir, filename);
+
+		std::shared_ptr<PrecompiledHeader> stored_pch(new PrecompiledHeader);
+		if (stored_pch->Load(pch_path) && stored_pch->IsUpToDate())
+		{
+			// Keep it from being evicted from the cache
+			TouchFile(pch_path);
+
+			// fcpp doesn't report the include files when they're not read
+			if (args.Have("-show_includes"))
+			{
+				for (size_t i = 1; i < stored_pch->Files().size(); i++)
+					printf("cpp: included \"%s\"\n", stored_pch->Files()[i].path.c_str());
+			}
+
+			pch = stored_pch;
+			return pch;
+		}
+	}
+
+	// Preprocess the header, capturing the state it leaves behind
+	std::vector<char> header_data;
+	if (!LoadFileData(header.c_str(), header_data))
+	{
+		printf("ERROR: Couldn't load precompiled header file '%s'\n", header.c_str());
+		return pch;
+	}
+	std::shared_ptr<PrecompiledHeader> new_pch(new PrecompiledHeader);
+	PPInfo pp_info;
+	pp_info.pch = new_pch.get();
+	if (!RunPreProcessor(args, header, header_data, target, 0, pp_info))
+	{
+		printf("ERROR: Failed to preprocess precompiled header file '%s'\n", header.c_str());
+		return pch;
+	}
+	DropUnusedLineDirective(pp_info.out_data);
+	new_pch->SetText(pp_info.out_data);
+
+	// Record the files read so that changes to them can be detected, starting with the header
+	bool have_files = new_pch->AddFile(header);
+	for (size_t i = 0; i < pp_info.included_files.size(); i++)
+		have_files &= new_pch->AddFile(pp_info.included_files[i]);
+
+	// Failure to store is not an error as the snapshot can always be made again
+	if (have_files && !pch_path.empty())
+		new_pch->Save(pch_path);
+
+	pch = new_pch;
+	return pch;
+}
+
+
+bool PreProcessFile(const Arguments& args, std::string filename, const std::vector<char>& in_data, ComputeTarget target, std::vector<char>& out_data, std::vector<std::string>& included_files, std::vector<TokenSpan>& token_spans)
+{
+	PPInfo pp_info;
+
+	// Restoring a precompiled header gives the same state as preprocessing it first
+	std::shared_ptr<const PrecompiledHeader> pch;
+	if (args.Have("-pch"))
+	{
+		pch = GetPrecompiledHeader(args, target);
+		if (!pch)
+			return false;
+
+		pp_info.out_data = pch->Text();
+		for (size_t i = 0; i < pch->Files().size(); i++)
+			pp_info.included_files.push_back(pch->Files()[i].path);
+	}
+
+	RunPreProcessor(args, filename, in_data, target, pch.get(), pp_info);
+
+	out_data.swap(pp_info.out_data);
+	included_files = pp_info.included_files;
+	token_spans.swap(pp_info.token_spans);
+	return true;
+}
+
+
+//
+// Files that can be written alongside the output of each target, with the extension they're cached with
+//
+struct SideOutput
+{
+	const char* option;
+	const char* extension;
+
+	// Whether the output refers to the file by its absolute path
+	bool path_in_output;
+
+	// Writes cached output back, merging it into files that are shared between runs over different inputs
+	bool (*write)(const std::string& filename, const std::vector<char>& data);
+};
+const SideOutput SIDE_OUTPUTS[] =
+{
+	{ "-output_bin", "bin", false, WriteFileIfChanged },
+	{ "-output_map", "map", false, WriteFileIfChanged },
+	{ "-output_header", "h", false, WriteFileIfChanged },
+	{ "-output_structs", "structs.h", false, WriteFileIfChanged },
+	{ "-output_texture_types", "types.h", true, MergeTextureTypesHeader },
+};
+
+
+// Side output filenames given for a single target, indexed by their cache extension
+typedef std::map<std::string, std::string> SideOutputFilenames;
+
+
+const SideOutput& FindSideOutput(const std::string& extension)
+{
+	size_t i = 0;
+	while (i < sizeof(SIDE_OUTPUTS) / sizeof(SIDE_OUTPUTS[0]) - 1 && extension != SIDE_OUTPUTS[i].extension)
+		i++;
+	return SIDE_OUTPUTS[i];
+}
+
+
+cmpU64 CacheInputKey(const Arguments& args, const std::string& input_filename, const std::vector<char>& input_file, ComputeTarget target, const SideOutputFilenames& side_output_filenames)
+{
+	// The paths of the input file and the executable end up in the output
+	cmpU64 key = Hash64String(CBPP_VERSION);
+	key = Hash64String(args[0], key);
+	key = Hash64String(GetAbsolutePath(input_filename), key);
+	key = Hash64(input_file.data(), input_file.size(), key);
+	key = HashPreProcessArgs(args, target, key);
+
+	// Which side outputs are stored with the output, along with the paths of those the output includes
+	for (size_t i = 0; i < sizeof(SIDE_OUTPUTS) / sizeof(SIDE_OUTPUTS[0]); i++)
+	{
+		const SideOutput& side_output = SIDE_OUTPUTS[i];
+		SideOutputFilenames::const_iterator filename = side_output_filenames.find(side_output.extension);
+		key = Hash64String(filename != side_output_filenames.end() ? side_output.option : "", key);
+		if (side_output.path_in_output && filename != side_output_filenames.end())
+			key = Hash64String(GetAbsolutePath(filename->second), key);
+	}
+
+	// Options that change the output
+	key = Hash64String(args.Have("-line_directives") ? "-line_directives" : "", key);
+	if (target == ComputeTarget_CUDA)
+	{
+		// The default size of a CUDA long depends on the platform cbpp is built for
+		cmpU32 long_size;
+		GetCudaLongSize(args, long_size);
+		key = Hash64(&long_size, sizeof(long_size), key);
+	}
+
+	return key;
+}
+
+
+bool GetCacheSize(const Arguments& args, cmpU64& size)
+{
+	size = 256ULL * 1024 * 1024;
+	if (!args.Have("-cache_size"))
+		return true;
+
+	// Only a whole, non-zero number of megabytes is accepted, as anything else would empty the cache
+	std::string cache_size = args.GetProperty("-cache_size");
+	if (cache_size.empty() || !isdigit((unsigned char)cache_size[0]))
+		return false;
+	char* end;
+	errno = 0;
+	unsigned long long size_mb = strtoull(cache_size.c_str(), &end, 10);
+	if (*end != 0 || errno == ERANGE || size_mb == 0 || size_mb > ~0ULL / (1024 * 1024))
+		return false;
+
+	size = size_mb * 1024 * 1024;
+	return true;
+}
+
+
+SideOutputFilenames GetSideOutputFilenames(const Arguments& args, size_t target_index)
+{
+	SideOutputFilenames filenames;
+	for (size_t i = 0; i < sizeof(SIDE_OUTPUTS) / sizeof(SIDE_OUTPUTS[0]); i++)
+	{
+		std::vector<std::string> option_filenames = SplitString(args.GetProperty(SIDE_OUTPUTS[i].option), ',');
+		if (target_index < option_filenames.size())
+			filenames[SIDE_OUTPUTS[i].extension] = option_filenames[target_index];
+	}
+	return filenames;
+}
+
+
+bool RestoreCachedOutput(const Arguments& args, OutputCache& cache, cmpU64 key, const std::string& output_filename, const SideOutputFilenames& side_output_filenames, std::vector<std::string>& included_files)
+{
+	std::vector<char> output;
+	OutputCache::SideOutputs side_outputs;
+	for (SideOutputFilenames::const_iterator i = side_output_filenames.begin(); i != side_output_filenames.end(); ++i)
+		side_outputs[i->first];
+	if (!cache.Load(key, output, side_outputs, included_files))
+		return false;
+
+	if (!WriteFileIfChanged(output_filename, output))
+		return false;
+	for (SideOutputFilenames::const_iterator i = side_output_filenames.begin(); i != side_output_filenames.end(); ++i)
+	{
+		if (!FindSideOutput(i->first).write(i->second, side_outputs[i->first]))
+			return false;
+	}
+
+	// Report includes the same way the preprocessor would have
+	if (args.Have("-show_includes"))
+	{
+		for (size_t i = 0; i < included_files.size(); i++)
+			printf("cpp: included \"%s\"\n", included_files[i].c_str());
+	}
+
+	return true;
+}
+
+
+void StoreCachedOutput(OutputCache& cache, cmpU64 key, const std::vector<std::string>& included_files, const std::vector<char>& output, const SideOutputFilenames& side_output_filenames)
+{
+	// Read back the side outputs written by the transforms and the emitter
+	OutputCache::SideOutputs side_outputs;
+	for (SideOutputFilenames::const_iterator i = side_output_filenames.begin(); i != side_output_filenames.end(); ++i)
+	{
+		if (!LoadFileData(i->second.c_str(), side_outputs[i->first]))
+			return;
+	}
+
+	cache.Store(key, included_files, output, side_outputs);
+}
+
+
+std::string EscapeMakePath(const std::string& path)
+{
+	// Make treats spaces as separators, '#' as a comment and '$' as a variable reference
+	std::string escaped;
+	for (size_t i = 0; i < path.length(); i++)
+	{
+		char c = path[i];
+		if (c == ' ' || c == '#')
+			escaped += '\\';
+		else if (c == '$')
+			escaped += '$';
+		escaped += c;
+	}
+	return escaped;
+}
+
+
+bool WriteDepfile(const std::string& filename, const std::vector<std::string>& outputs, const std::string& input_filename, const std::vector< std::vector<std::string> >& included_files)
+{
+	// All outputs share the one rule
+	std::string rule;
+	for (size_t i = 0; i < outputs.size(); i++)
+	{
+		if (i != 0)
+			rule += ' ';
+		rule += EscapeMakePath(outputs[i]);
+	}
+	rule += ':';
+
+	// Targets can include different files so gather the union of them all
+	std::vector<std::string> depends(1, input_filename);
+	for (size_t i = 0; i < included_files.size(); i++)
+	{
+		for (size_t j = 0; j < included_files[i].size(); j++)
+		{
+			const std::string& depend = included_files[i][j];
+			if (std::find(depends.begin(), depends.end(), depend) == depends.end())
+				depends.push_back(depend);
+		}
+	}
+	for (size_t i = 0; i < depends.size(); i++)
+	{
+		rule += " \\\n  ";
+		rule += EscapeMakePath(depends[i]);
+	}
+	rule += '\n';
+
+	return WriteFileIfChanged(filename, std::vector<char>(rule.begin(), rule.end()));
+}
+
+
+//
+// Processors for each target, destroyed in reverse order so that any that share the parse of another
+// are released first
+//
+struct TargetProcessors
+{
+	~TargetProcessors()
+	{
+		for (size_t i = processors.size(); i-- > 0; )
+			delete processors[i];
+	}
+
+	std::vector<ComputeProcessor*> processors;
+};
+
+
+int ProcessCommandLine(int argc, const char* argv[])
 {
 	// Build arguments object, expecting a filename
 	Arguments args(argc, argv);
@@ -324,20 +922,42 @@ int main(int argc, const char* argv[])
 	if (!args.Have("-noheader"))
 		PrintHeader();
 
-	// Decide for which target to emit
-	std::string target_name = args.GetProperty("-target");
-	std::transform(target_name.begin(), target_name.end(), target_name.begin(), tolower);
-	ComputeTarget target = ComputeTarget_None;
-	if (target_name == "cuda")
-		target = ComputeTarget_CUDA;
-	else if (target_name == "opencl")
-		target = ComputeTarget_OpenCL;
-	else
+	// Decide for which targets to emit
+	std::vector<std::string> target_names = SplitString(args.GetProperty("-target"), ',');
+	std::vector<ComputeTarget> targets;
+	for (size_t i = 0; i < target_names.size(); i++)
+	{
+		ComputeTarget target = ComputeTargetFromName(target_names[i]);
+		if (target == ComputeTarget_None || std::find(targets.begin(), targets.end(), target) != targets.end())
+		{
+			printf("ERROR: Valid compute target not specified\n\n");
+			return 1;
+		}
+		targets.push_back(target);
+	}
+	if (targets.empty())
 	{
 		printf("ERROR: Valid compute target not specified\n\n");
 		return 1;
 	}
 
+	// Each target requires its own output files
+	std::vector<std::string> output_filenames = SplitString(output_filename, ',');
+	if (output_filenames.size() != targets.size())
+	{
+		printf("ERROR: Expecting one output filename for each target\n\n");
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(SIDE_OUTPUTS) / sizeof(SIDE_OUTPUTS[0]); i++)
+	{
+		const char* option = SIDE_OUTPUTS[i].option;
+		if (args.Have(option) && SplitString(args.GetProperty(option), ',').size() != targets.size())
+		{
+			printf("ERROR: Expecting one %s filename for each target\n\n", option);
+			return 1;
+		}
+	}
+
 	// Load the input file
 	std::string input_filename = args[1];
 	std::vector<char> input_file;
@@ -347,22 +967,153 @@ int main(int argc, const char* argv[])
 		return 1;
 	}
 
-	input_file = PreProcessFile(args, input_filename, input_file, target);
-
-	ComputeProcessor processor(args, input_filename, input_file, target);
-	if (!processor.ParseFile())
+	// Targets whose output is cached don't need any further work
+	cmpU64 cache_size;
+	if (!GetCacheSize(args, cache_size))
+	{
+		printf("ERROR: -cache_size must be a whole number of megabytes greater than zero\n\n");
+		return 1;
+	}
+	cmpU32 cuda_long_size;
+	if (!GetCudaLongSize(args, cuda_long_size))
+	{
+		printf("ERROR: -cuda_long_size must be 4 or 8\n\n");
 		return 1;
+	}
+	OutputCache cache(args.GetProperty("-cache_dir"), cache_size);
+	std::vector<SideOutputFilenames> side_output_filenames(targets.size());
+	std::vector<cmpU64> cache_keys(targets.size());
+	std::vector<bool> cached(targets.size());
+	std::vector< std::vector<std::string> > included_files(targets.size());
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		side_output_filenames[i] = GetSideOutputFilenames(args, i);
+		cache_keys[i] = CacheInputKey(args, input_filename, input_file, targets[i], side_output_filenames[i]);
+		cached[i] = RestoreCachedOutput(args, cache, cache_keys[i], output_filenames[i], side_output_filenames[i], included_files[i]);
+	}
+
+	// Preprocessing has to be repeated as the target define can change the output. Only targets whose
+	// preprocessed output differs from all previous targets need to be parsed, the rest share a parse.
+	TargetProcessors target_processors;
+	std::vector< std::vector<char> > pp_files(targets.size());
+	std::vector< std::vector<TokenSpan> > pp_token_spans(targets.size());
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		if (cached[i])
+		{
+			target_processors.processors.push_back(0);
+			continue;
+		}
 
-	cmpError error = processor.ApplyTransforms();
-	if (!cmpError_OK(&error))
-		printf("%s\n", error.text);
+		if (!PreProcessFile(args, input_filename, input_file, targets[i], pp_files[i], included_files[i], pp_token_spans[i]))
+			return 1;
+
+		size_t source = 0;
+		while (source < i && (cached[source] || pp_files[source] != pp_files[i]))
+			source++;
+
+		ComputeProcessor* processor;
+		if (source < i)
+			processor = new ComputeProcessor(*target_processors.processors[source], targets[i]);
+		else
+			processor = new ComputeProcessor(args, input_filename, pp_files[i], pp_token_spans[i], targets[i]);
+		target_processors.processors.push_back(processor);
+
+		if (!processor->ParseFile())
+			return 1;
+	}
 
-	EmitFile emitter(output_filename.c_str());
-	if (!processor.VisitNodes(&emitter))
+	// Transforms can only be applied once all parses have been shared
+	for (size_t i = 0; i < targets.size(); i++)
 	{
-		printf("%s\n", emitter.last_error.text);
-		return 1;
+		if (cached[i])
+			continue;
+		ComputeProcessor& processor = *target_processors.processors[i];
+
+		cmpError error = processor.ApplyTransforms();
+		if (!cmpError_OK(&error))
+			printf("%s\n", error.text);
+
+		// Locating the output in the original files needs the line directives of the preprocessed file
+		bool line_directives = args.Have("-line_directives");
+		SideOutputFilenames::const_iterator map_filename = side_output_filenames[i].find("map");
+		bool have_map = map_filename != side_output_filenames[i].end();
+		SourceMap source_map;
+		if (have_map || line_directives)
+			source_map.SetPreProcessedText(pp_files[i]);
+
+		EmitFile emitter(have_map || line_directives ? &source_map : 0, line_directives);
+		processor.VisitNodes(&emitter);
+		emitter.EndLine();
+		if (!WriteFileIfChanged(output_filenames[i], emitter.data))
+		{
+			printf("Couldn't open file '%s' for writing\n", output_filenames[i].c_str());
+			return 1;
+		}
+
+		if (have_map)
+		{
+			std::vector<char> output_map;
+			source_map.Write(output_map);
+			if (!WriteFileIfChanged(map_filename->second, output_map))
+			{
+				printf("Couldn't open file '%s' for writing\n", map_filename->second.c_str());
+				return 1;
+			}
+		}
+
+		// Only output generated without error is worth caching
+		if (cmpError_OK(&error))
+			StoreCachedOutput(cache, cache_keys[i], included_files[i], emitter.data, side_output_filenames[i]);
+	}
+
+	// Optionally let the build system know which files the outputs depend on
+	if (args.Have("-MD") || args.Have("-MF"))
+	{
+		std::string depfile = args.GetProperty("-MF");
+		if (depfile == "")
+			depfile = output_filenames[0] + ".d";
+
+		std::vector<std::string> outputs = output_filenames;
+		for (size_t i = 0; i < side_output_filenames.size(); i++)
+		{
+			for (SideOutputFilenames::const_iterator j = side_output_filenames[i].begin(); j != side_output_filenames[i].end(); ++j)
+				outputs.push_back(j->second);
+		}
+		if (!WriteDepfile(depfile, outputs, input_filename, included_files))
+		{
+			printf("ERROR: Failed to write dependency file %s\n", depfile.c_str());
+			return 1;
+		}
 	}
 
 	return 0;
 }
+
+
+int main(int argc, const char* argv[])
+{
+	// Stay resident, processing command-lines sent by clients
+	if (argc == 3 && strcmp(argv[1], "--server") == 0)
+		return RunServer(argv[2], ProcessCommandLine);
+
+	// Forward the command-line to a server if requested, falling back to processing it locally
+	// when there's no server to connect to
+	std::vector<const char*> client_argv;
+	std::string socket_path;
+	for (int i = 0; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-connect") == 0 && i + 1 < argc)
+			socket_path = argv[++i];
+		else
+			client_argv.push_back(argv[i]);
+	}
+	if (socket_path != "")
+	{
+		int exit_code;
+		if (RunClient(socket_path, (int)client_argv.size(), client_argv.data(), exit_code))
+			return exit_code;
+	}
+
+	return ProcessCommandLine((int)client_argv.size(), client_argv.data());
+}
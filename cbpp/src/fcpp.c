@@ -234,6 +234,7 @@ SOFTWARE.
  * PAR_MAC	The maximum number of #define parameters (31 per Standard)
  *		Note: we need another one for strings.
  * NBUFF	Input buffer size
+ * NOUTBUF	Output buffer size for FPPTAG_OUTPUT_BLOCK
  * NWORK	Work buffer size -- the longest macro
  *		must fit here after expansion.
  * NEXP 	The nesting depth of #if expressions
@@ -250,6 +251,10 @@ SOFTWARE.
 #define NBUFF			512
 #endif
 
+#ifndef NOUTBUF
+#define NOUTBUF 		4096
+#endif
+
 #ifndef NWORK
 #define NWORK			512
 #endif
@@ -311,7 +316,9 @@ SOFTWARE.
 #define REG(x)
 
 /*
- * SBSIZE defines the number of hash-table slots for the symbol table.
+ * SBSIZE defines the initial number of hash-table slots for the symbol
+ * table. It must be a power of two. The table doubles in size whenever
+ * it becomes half full.
  */
 #ifndef SBSIZE
 #define SBSIZE  64
@@ -459,13 +466,23 @@ SOFTWARE.
  */
 
 typedef struct defbuf {
-	struct defbuf	*link;		/* Next define in chain */
 	char		*repl;		/* -> replacement	*/
-	int		hash;		/* Symbol table hash	*/
+	unsigned int	hash;		/* Symbol table hash	*/
 	int		nargs;		/* For define(args)     */
 	char		name[1];	/* #define name 	*/
 } DEFBUF;
 
+/*
+ * Symbol names are hashed with FNV-1a, a character at a time.
+ * SYM_DELETED marks a symbol table slot whose symbol was removed
+ * so that probing continues past it.
+ */
+#define SYM_HASH_SEED	2166136261u
+#define SYM_HASH(h, c)	(((h) ^ ((c) & 0xFF)) * 16777619u)
+
+static char symdeleted;
+#define SYM_DELETED	((DEFBUF *) &symdeleted)
+
 /*
  * The FILEINFO structure stores information about open files
  * and macros being expanded.
@@ -479,9 +496,51 @@ typedef struct fileinfo {
 	char		*filename;	/* File/macro name	*/
 	char		*progname;	/* From #line statement */
 	unsigned int	unrecur;	/* For macro recursion	*/
+	char		*mptr;		/* Next char if in memory */
+	char		*mend;		/* End of memory input	*/
+	char		guardstate;	/* Include guard detection */
+	int		guarddepth;	/* #if depth of the guard */
+	char		*guard;		/* Include guard macro	*/
 	char		buffer[1];	/* current input line	*/
 } FILEINFO;
 
+/*
+ * Include guard detection states. A file is guarded when the first
+ * directive is an #ifndef, nothing but white space and comments
+ * comes before it or after its matching #endif, and no #else or
+ * #elif belongs to it.
+ */
+#define GUARD_START	0		/* Nothing seen yet		*/
+#define GUARD_INSIDE	1		/* Inside the #ifndef		*/
+#define GUARD_DONE	2		/* Matching #endif seen 	*/
+#define GUARD_NONE	3		/* Not a guarded file		*/
+
+/*
+ * The GUARDFILE structure lists the files that needn't be read again
+ * while their guard macro is defined, or ever for #pragma once.
+ */
+
+typedef struct guardfile {
+	struct guardfile *next;		/* Next file in list	*/
+	char		*guard;		/* NULL for #pragma once */
+	char		filename[1];	/* Name the file was opened as */
+} GUARDFILE;
+
+/*
+ * The INCPATH structure remembers where an #include was found, or
+ * that it wasn't, so that the search isn't repeated. Whether the
+ * includer's directory was searched, as it is for #include "file",
+ * and that directory are part of the key.
+ */
+
+typedef struct incpath {
+	struct incpath	*next;		/* Next result in list	*/
+	int		local;		/* TRUE if localdir searched */
+	char		*localdir;	/* Includer's directory or "" */
+	char		*resolved;	/* NULL if not found	*/
+	char		name[1];	/* #include argument	*/
+} INCPATH;
+
 /*
  * The SIZES structure is used to store the values for #if sizeof
  */
@@ -491,19 +550,6 @@ typedef struct sizes {
     short	size;			/* this is the datum size value */
     short	psize;			/* this is the pointer size	*/
 } SIZES;
-/*
- * nomacarg is a built-in #define on Decus C.
- */
-
-#ifdef	nomacarg
-#define cput		output		/* cput concatenates tokens	*/
-#else
-#if COMMENT_INVISIBLE
-#define cput(c)         { if (c != TOK_SEP && c != COM_SEP) putchar(c); }
-#else
-#define cput(c)         { if (c != TOK_SEP) putchar(c); }
-#endif
-#endif
 
 #ifndef nomacarg
 #define streq(s1, s2)   (strcmp(s1, s2) == 0)
@@ -689,7 +735,9 @@ struct Global {
 
   DEFBUF *macro;                /* Catches start of infinite macro      */
 
-  DEFBUF *symtab[SBSIZE];       /* Symbol table queue headers   */
+  DEFBUF **symtab;              /* Symbol table slots           */
+  int symsize;                  /* Number of slots, power of 2  */
+  int symused;                  /* Slots not NULL, incl deleted */
 
   int evalue;                   /* Current value from evallex() */
 
@@ -745,8 +793,37 @@ struct Global {
   char webmode; /* WWW process mode */
 
   char allowincludelocal;
+
+  void (*depends)(char *, void *); /* called for each opened include file */
+
+  char *inbuffer;       /* main input file held in memory */
+  size_t inbuffersize;
+
+  void (*outputblock)(char *, int, void *); /* block output function */
+
+  char *(*openfunc)(char *, size_t *, void *); /* include file reader */
+
+  GUARDFILE *guardfiles;        /* Files skipped when included  */
+  INCPATH *incpaths;            /* Resolved #include searches   */
+
+  void (*dumpmacros)(struct fppMacro *, void *); /* reports final macros */
+  void (*dumpguards)(struct fppGuard *, void *); /* reports guarded files */
+
+  void (*outputtoken)(int, size_t, size_t, void *); /* token span function */
+  int tokentype;        /* Span not reported yet, or 0      */
+  size_t tokenstart;
+  size_t tokenend;
+
+  size_t outflushed;    /* characters output before outbuffer */
+  int outcount;         /* characters waiting in outbuffer */
+  char outbuffer[NOUTBUF];
 };
 
+/*
+ * Offset in the output of the next character written.
+ */
+#define OUTPOS(global)	((global)->outflushed + (global)->outcount)
+
 typedef enum {
   ERROR_STRING_MUST_BE_IF,
   ERROR_STRING_MAY_NOT_FOLLOW_ELSE,
@@ -867,6 +944,9 @@ void Error(struct Global *, char *, ...);
 void Putchar(struct Global *, int);
 void Putstring(struct Global *, char *);
 void Putint(struct Global *, int);
+void Flushoutput(struct Global *);
+void outtoken(struct Global *, int, size_t);
+void flushtoken(struct Global *);
 char *savestring(struct Global *, char *);
 ReturnCode addfile(struct Global *, FILE *, char *);
 int catenate(struct Global *, ReturnCode *);
@@ -909,6 +989,19 @@ ReturnCode expstuff(struct Global *, char *, char *);
 
 FILE_LOCAL ReturnCode output(struct Global *, int); /* Output one character */
 FILE_LOCAL void sharp(struct Global *);
+FILE_LOCAL void freeglobal(struct Global *);
+FILE_LOCAL void dumpmacros(struct Global *);
+FILE_LOCAL void dumpguards(struct Global *);
+FILE_LOCAL char *memgets(char *, int, FILEINFO *);
+FILE_LOCAL int skipinactive(struct Global *);
+FILE_LOCAL DEFBUF **symfind(struct Global *, char *, unsigned int, int);
+FILE_LOCAL ReturnCode symgrow(struct Global *);
+FILE_LOCAL DEFBUF *symlookup(struct Global *, char *);
+FILE_LOCAL int ispragmaonce(char *);
+FILE_LOCAL void addguardfile(struct Global *, char *, char *);
+FILE_LOCAL int isguarded(struct Global *, char *);
+FILE_LOCAL INCPATH *findincpath(struct Global *, int, char *, char *);
+FILE_LOCAL void addincpath(struct Global *, int, char *, char *, char *);
 INLINE FILE_LOCAL ReturnCode cppmain(struct Global *);
 
 int fppPreProcess(struct fppTag *tags)
@@ -991,14 +1084,41 @@ int fppPreProcess(struct fppTag *tags)
   global->initialfunc = NULL;
 
   global->allowincludelocal = TRUE;
-
-  memset(global->symtab, 0, SBSIZE * sizeof(DEFBUF *));
+  global->depends = NULL;
+
+  global->inbuffer = NULL;
+  global->inbuffersize = 0;
+  global->outputblock = NULL;
+  global->outflushed = 0;
+  global->outcount = 0;
+  global->openfunc = NULL;
+  global->guardfiles = NULL;
+  global->incpaths = NULL;
+  global->dumpmacros = NULL;
+  global->dumpguards = NULL;
+  global->outputtoken = NULL;
+  global->tokentype = 0;
+
+  global->symsize = SBSIZE;
+  global->symused = 0;
+  global->symtab = (DEFBUF **) calloc(SBSIZE, sizeof(DEFBUF *));
+  if(!global->symtab) {
+    free(global);
+    return(FPP_OUT_OF_MEMORY);
+  }
 
   ret=initdefines(global);  /* O.S. specific def's  */
-  if(ret)
+  if(!ret)
+    ret=dooptions(global, tags);  /* Command line -flags  */
+  if(ret) {
+    freeglobal(global);
     return(ret);
-  dooptions(global, tags);  /* Command line -flags  */
+  }
   ret=addfile(global, stdin, global->work); /* "open" main input file       */
+  if(!ret && global->inbuffer) {
+    global->infile->mptr = global->inbuffer;
+    global->infile->mend = global->inbuffer + global->inbuffersize;
+  }
 
   global->out = global->outputfile;
 
@@ -1011,12 +1131,123 @@ int fppPreProcess(struct fppTag *tags)
     cerror(global, ERROR_IFDEF_DEPTH, i);
 #endif
   }
-  fflush(stdout);
-  fclose(stdout);
+  flushtoken(global);
+  Flushoutput(global);
+  if (global->dumpmacros)
+    dumpmacros(global);
+  if (global->dumpguards)
+    dumpguards(global);
+  /* Leave stdout open so that the host can print and preprocess again */
+  if (!global->output && !global->outputblock)
+    fflush(stdout);
 
   if (global->errors > 0 && !global->eflag)
-    return(IO_ERROR);
-  return(IO_NORMAL);       /* No errors or -E option set   */
+    i = IO_ERROR;
+  else
+    i = IO_NORMAL;       /* No errors or -E option set   */
+
+  freeglobal(global);
+  return(i);
+}
+
+FILE_LOCAL
+void dumpmacros(struct Global *global)
+{
+  /*
+   * Report every macro defined by the preprocessed source (or the
+   * tags) to the host, leaving out __FILE__, __LINE__ and friends
+   * as they depend on when and where they're expanded.
+   */
+  struct fppMacro macro;
+  DEFBUF *dp;
+  int i;
+
+  for (i = 0; i < global->symsize; i++) {
+    dp = global->symtab[i];
+    if (dp == NULL || dp == SYM_DELETED || dp->nargs < DEF_NOARGS
+        || streq(dp->name, "__DATE__") || streq(dp->name, "__TIME__"))
+      continue;
+    macro.name = dp->name;
+    macro.nargs = dp->nargs;
+    macro.repl = dp->repl;
+    global->dumpmacros(&macro, global->userdata);
+  }
+}
+
+FILE_LOCAL
+void dumpguards(struct Global *global)
+{
+  /*
+   * Report the files that including again would have no effect on,
+   * so that the host can carry them over to another run along with
+   * the macros their guards depend on.
+   */
+  struct fppGuard guard;
+  GUARDFILE *gp;
+
+  for (gp = global->guardfiles; gp != NULL; gp = gp->next) {
+    guard.filename = gp->filename;
+    guard.guard = gp->guard;
+    global->dumpguards(&guard, global->userdata);
+  }
+}
+
+FILE_LOCAL
+void freeglobal(struct Global *global)
+{
+  /*
+   * Release everything allocated while preprocessing so that a host
+   * can call fppPreProcess() any number of times without leaking.
+   */
+  FILEINFO *file;
+  DEFBUF *dp;
+  GUARDFILE *gp;
+  INCPATH *ip;
+  int i;
+
+  /* Files left open when processing stopped early */
+  while ((file = global->infile) != NULL) {
+    global->infile = file->parent;
+    if (file->fp != NULL && file->fp != stdin)
+      fclose(file->fp);
+    free(file->filename);
+    if (file->progname != NULL)
+      free(file->progname);
+    if (file->guard != NULL)
+      free(file->guard);
+    free(file);
+  }
+
+  while ((gp = global->guardfiles) != NULL) {
+    global->guardfiles = gp->next;
+    if (gp->guard != NULL)
+      free(gp->guard);
+    free(gp);
+  }
+
+  while ((ip = global->incpaths) != NULL) {
+    global->incpaths = ip->next;
+    free(ip->localdir);
+    if (ip->resolved != NULL)
+      free(ip->resolved);
+    free(ip);
+  }
+
+  for (i = 0; i < global->symsize; i++) {
+    dp = global->symtab[i];
+    if (dp != NULL && dp != SYM_DELETED) {
+      if (dp->repl != NULL)
+        free(dp->repl);
+      free(dp);
+    }
+  }
+  free(global->symtab);
+
+  free(global->tokenbuf);
+  free(global->functionname);
+  free(global->spacebuf);
+  free(global->sharpfilename);
+  free(global);
 }
 
 INLINE FILE_LOCAL
@@ -1046,6 +1277,7 @@ ReturnCode cppmain(struct Global *global)
   char go = 0;
   int include = 0;
   char initfunc = 0;
+  size_t start;         /* Output offset of a token */
 
   /* Initialize for reading tokens */
   global->tokenbsize = 50;
@@ -1099,6 +1331,8 @@ ReturnCode cppmain(struct Global *global)
   for (;;) {
     counter = 0;                        /* Count empty lines    */
     for (;;) {                          /* For each line, ...   */
+      if (!compiling)                   /* Race through #if 0's */
+	counter += skipinactive(global);
       global->comment = FALSE;          /* No comment yet!      */
       global->chpos = 0;                /* Count whitespaces    */
       while (type[(c = get(global))] == SPA)  /* Skip leading blanks */
@@ -1128,6 +1362,9 @@ ReturnCode cppmain(struct Global *global)
 	skipnl(global);                 /* Skip to newline      */
 	counter++;                      /* Count it, too.       */
       } else {
+	if (global->infile->fp != NULL
+	    && global->infile->guardstate != GUARD_INSIDE)
+	  global->infile->guardstate = GUARD_NONE; /* Outside guard */
 	break;                          /* Actual token         */
       }
     }
@@ -1192,7 +1429,9 @@ ReturnCode cppmain(struct Global *global)
       case LET:
 	go =0;
 	/* Quite ordinary token */
+	start = OUTPOS(global);
 	Putstring(global, global->tokenbuf);
+	outtoken(global, FPP_TOKEN_NAME, start);
 	
 	if(!define) {
 	  /* Copy the name */
@@ -1204,18 +1443,26 @@ ReturnCode cppmain(struct Global *global)
       case DIG:                 /* Output a number      */
       case DOT:                 /* Dot may begin floats */
 	go = 0;
+	if (c == '.')             /* Not joined to a name */
+	  flushtoken(global);
+	start = OUTPOS(global);
 	ret=scannumber(global, c, (ReturnCode(*)(struct Global *, int))output);
 	if(ret)
 	  return(ret);
+	if (c != '.' || OUTPOS(global) - start > 1)
+	  outtoken(global, FPP_TOKEN_NUMBER, start);
 	break;
       case QUO:                 /* char or string const */
 	go = 0;
 	/* Copy it to output */
         if(!global->webmode) {
+          start = OUTPOS(global);
           ret=scanstring(global, c,
                          (ReturnCode(*)(struct Global *, int))output);
           if(ret)
             return(ret);
+          if (c == '"')
+            outtoken(global, FPP_TOKEN_STRING, start);
           break;
         }
         /* FALLTHROUGH */
@@ -1385,14 +1632,14 @@ void Putchar(struct Global *global, int c)
    */
   if(!global->out)
     return;
-#if defined(UNIX)
-  if(global->output)
+  if(global->output && !global->outputblock) {
     global->output(c, global->userdata);
-  else
-    putchar(c);
-#else
-  global->output(c, global->userdata);
-#endif
+    global->outflushed++;
+    return;
+  }
+  global->outbuffer[global->outcount++] = (char)c;
+  if(global->outcount == NOUTBUF)
+    Flushoutput(global);
 }
 
 void Putstring(struct Global *global, char *string)
@@ -1401,9 +1648,29 @@ void Putstring(struct Global *global, char *string)
    * Output a string! One letter at a time to the Putchar routine!
    */
 
+  int length;
+  int count;
+
   if(!string)
     return;
 
+  if(global->out && (global->outputblock || !global->output)) {
+    /* Copy whole runs into the output buffer */
+    length = strlen(string);
+    while(length > 0) {
+      count = NOUTBUF - global->outcount;
+      if(count > length)
+        count = length;
+      memcpy(global->outbuffer + global->outcount, string, count);
+      global->outcount += count;
+      string += count;
+      length -= count;
+      if(global->outcount == NOUTBUF)
+        Flushoutput(global);
+    }
+    return;
+  }
+
   while(*string)
     Putchar(global, *string++);
 }
@@ -1423,6 +1690,61 @@ void Putint(struct Global *global, int number)
     Putchar(global, *point++);
 }
 
+void Flushoutput(struct Global *global)
+{
+  /*
+   * Hand any buffered output to the block output function, or
+   * write it to stdout in one go if there isn't one.
+   */
+
+  if(global->outcount > 0) {
+    if(global->outputblock)
+      global->outputblock(global->outbuffer, global->outcount, global->userdata);
+    else
+      fwrite(global->outbuffer, 1, global->outcount, stdout);
+    global->outflushed += global->outcount;
+    global->outcount = 0;
+  }
+}
+
+void outtoken(struct Global *global, int type, size_t start)
+{
+  /*
+   * Report the span of output written since start as a token.  Names
+   * and numbers written with nothing between them make one token, so
+   * each span is held back until the next one is known.
+   */
+
+  size_t end = OUTPOS(global);
+
+  if(!global->outputtoken || !global->out || end == start)
+    return;
+  if(global->tokenend == start && type != FPP_TOKEN_STRING &&
+     (global->tokentype == FPP_TOKEN_NAME ||
+      global->tokentype == FPP_TOKEN_NUMBER)) {
+    global->tokenend = end;             /* Join on to the last  */
+    return;
+  }
+  flushtoken(global);
+  global->tokentype = type;
+  global->tokenstart = start;
+  global->tokenend = end;
+}
+
+void flushtoken(struct Global *global)
+{
+  /*
+   * Report any token span held back by outtoken().
+   */
+
+  if(global->tokentype) {
+    global->outputtoken(global->tokentype, global->tokenstart,
+                        global->tokenend - global->tokenstart,
+                        global->userdata);
+    global->tokentype = 0;
+  }
+}
+
 
 FILE_LOCAL
 void sharp(struct Global *global)
@@ -1505,6 +1827,7 @@ ReturnCode control( struct Global *global,
     int hash;
     char *ep;
     ReturnCode ret;
+    FILEINFO *file;
 
     c = skipws( global );
 
@@ -1584,6 +1907,28 @@ ReturnCode control( struct Global *global,
     if( global->infile->fp == NULL )
         cwarn( global, WARN_CONTROL_LINE_IN_MACRO, global->tokenbuf );
 
+    /*
+     * Follow include guard detection for the current file. The first
+     * #ifndef is picked up once doif() has read the guard name.
+     */
+    file = global->infile;
+
+    if( file->fp != NULL )
+        {
+        if( file->guardstate == GUARD_INSIDE )
+            {
+            if( global->ifptr - global->ifstack == file->guarddepth )
+                {
+                if( hash == L_endif )
+                    file->guardstate = GUARD_DONE;
+                else if( hash == L_else || hash == L_elif )
+                    file->guardstate = GUARD_NONE;
+                }
+            }
+        else if( file->guardstate != GUARD_START || hash != L_ifndef )
+            file->guardstate = GUARD_NONE;
+        }
+
     if( !compiling )
         {                       /* Not compiling now    */
         switch( hash )
@@ -1776,6 +2121,13 @@ ReturnCode control( struct Global *global,
                 if( ret )
                     return(ret);
 
+                if( file->fp != NULL && file->guardstate == GUARD_START )
+                    {
+                    file->guard = savestring( global, global->tokenbuf );
+                    file->guarddepth = global->ifptr - global->ifstack;
+                    file->guardstate = GUARD_INSIDE;
+                    }
+
                 break;
                 }
 
@@ -1819,8 +2171,20 @@ ReturnCode control( struct Global *global,
         case L_pragma:
             /*
              * #pragma is provided to pass "options" to later
-             * passes of the compiler.  cpp doesn't have any yet.
+             * passes of the compiler.  cpp only handles "once".
              */
+            if( file->fp != NULL && ispragmaonce( file->bptr ) )
+                {
+                addguardfile( global, file->filename, NULL );
+
+                while( (c = get( global ) ) != '\n' && c != EOF_CHAR )
+                    ;
+
+                unget( global );
+
+                break;
+                }
+
             Putstring( global, "#pragma " );
 
             while( (c = get( global ) ) != '\n' && c != EOF_CHAR )
@@ -2056,6 +2420,9 @@ ReturnCode openinclude( struct Global *global,
 
     char **incptr;
     char tmpname[NWORK]; /* Filename work area    */
+    char localdir[NWORK]; /* Includer's directory */
+    int local;           /* TRUE if localdir is searched */
+    INCPATH *ip;
     int len;
 
     if( filename[0] == '/' )
@@ -2064,7 +2431,26 @@ ReturnCode openinclude( struct Global *global,
             return(FPP_OK);
         }
 
-    if( searchlocal && global->allowincludelocal )
+    localdir[0] = EOS;
+
+    local = searchlocal && global->allowincludelocal;
+    if( local )
+        hasdirectory( global->infile->filename, localdir );
+
+    /*
+     * Go straight to the result of an earlier search for the same file,
+     * only searching again if a found file can no longer be opened.
+     */
+    if( (ip = findincpath( global, local, localdir, filename )) != NULL )
+        {
+        if( ip->resolved == NULL )
+            return( FPP_NO_INCLUDE );
+
+        if( ! openfile( global, ip->resolved ) )
+            return(FPP_OK);
+        }
+
+    if( local )
         {
         /*
          * Look in local directory first.
@@ -2075,13 +2461,20 @@ ReturnCode openinclude( struct Global *global,
          * name then tacking on the #include argument.
          */
 
-        if( hasdirectory( global->infile->filename, tmpname ) )
-            strcat( tmpname, filename );
-        else
-            strcpy( tmpname, filename );
+        if( strlen(localdir) + strlen(filename) >= sizeof(tmpname) )
+            {
+            cfatal( global, FATAL_FILENAME_BUFFER_OVERFLOW );
+            return( FPP_FILENAME_BUFFER_OVERFLOW );
+            }
+        strcpy( tmpname, localdir );
+        strcat( tmpname, filename );
 
         if( ! openfile( global, tmpname ) )
+            {
+            addincpath( global, local, localdir, filename, tmpname );
+
             return(FPP_OK);
+            }
         }
 
     /*
@@ -2106,13 +2499,78 @@ ReturnCode openinclude( struct Global *global,
                 sprintf( tmpname, "%s%s", *incptr, filename );
 
             if( !openfile( global, tmpname ) )
+                {
+                addincpath( global, local, localdir, filename, tmpname );
+
                 return(FPP_OK);
+                }
             }
         }
 
+    addincpath( global, local, localdir, filename, NULL );
+
     return( FPP_NO_INCLUDE );
 }
 
+FILE_LOCAL
+INCPATH *findincpath( struct Global *global,
+    int local,          /* TRUE if localdir is searched */
+    char *localdir,     /* Includer's directory or "" */
+    char *filename )    /* #include argument          */
+{
+    /*
+     * Find the result of an earlier search for an include file.
+     */
+
+    INCPATH *ip;
+
+    for( ip = global->incpaths; ip != NULL; ip = ip->next )
+        {
+        if( ip->local == local && streq( ip->name, filename ) &&
+            streq( ip->localdir, localdir ) )
+            return( ip );
+        }
+
+    return( NULL );
+}
+
+FILE_LOCAL
+void addincpath( struct Global *global,
+    int local,          /* TRUE if localdir is searched */
+    char *localdir,     /* Includer's directory or "" */
+    char *filename,     /* #include argument          */
+    char *resolved )    /* Path found, NULL if none   */
+{
+    /*
+     * Remember the result of searching for an include file.
+     */
+
+    INCPATH *ip;
+
+    if( (ip = findincpath( global, local, localdir, filename )) != NULL )
+        {
+        /* Replace a result that has gone stale */
+        if( ip->resolved != NULL )
+            free( ip->resolved );
+
+        ip->resolved = (resolved != NULL) ? savestring( global, resolved ) : NULL;
+
+        return;
+        }
+
+    ip = (INCPATH *) malloc( sizeof (INCPATH) + strlen(filename) );
+
+    if( ip == NULL )
+        return;                 /* Just search again    */
+
+    strcpy( ip->name, filename );
+    ip->local = local;
+    ip->localdir = savestring( global, localdir );
+    ip->resolved = (resolved != NULL) ? savestring( global, resolved ) : NULL;
+    ip->next = global->incpaths;
+    global->incpaths = ip;
+}
+
 INLINE FILE_LOCAL
 int hasdirectory( char *source,   /* Directory to examine         */
     char *result )  /* Put directory stuff here     */
@@ -2144,12 +2602,31 @@ ReturnCode openfile(struct Global *global, char *filename)
 
   FILE *fp;
   ReturnCode ret;
+  char *data;
+  size_t size;
 
-  if ((fp = fopen(filename, "r")) == NULL)
+  if (isguarded(global, filename))
+    return(FPP_OK);                     /* Nothing to read again */
+
+  if (global->openfunc) {
+    /*
+     * Read from memory, with stdin standing in for the file pointer
+     * as it does for the main file.
+     */
+    if ((data = global->openfunc(filename, &size, global->userdata)) == NULL)
+      ret=FPP_OPEN_ERROR;
+    else if (!(ret=addfile(global, stdin, filename))) {
+      global->infile->mptr = data;
+      global->infile->mend = data + size;
+    }
+  } else if ((fp = fopen(filename, "r")) == NULL)
     ret=FPP_OPEN_ERROR;
   else
     ret=addfile(global, fp, filename);
 
+  if(!ret && global->depends)
+    global->depends(filename, global->userdata);
+
   if(!ret && global->showincluded) {
           /* no error occured! */
           Error(global, "cpp: included \"");
@@ -2159,6 +2636,58 @@ ReturnCode openfile(struct Global *global, char *filename)
   return(ret);
 }
 
+FILE_LOCAL
+int ispragmaonce(char *cp)      /* Rest of the #pragma line     */
+{
+  /*
+   * Return TRUE if the #pragma is "once".
+   */
+
+  while (*cp == ' ' || *cp == '\t')
+    cp++;
+  return (strncmp(cp, "once", 4) == 0
+          && type[cp[4] & 0xFF] != LET && type[cp[4] & 0xFF] != DIG);
+}
+
+FILE_LOCAL
+void addguardfile(struct Global *global,
+                  char *filename,       /* Name the file was opened as */
+                  char *guard)          /* Guard macro, NULL if once   */
+{
+  /*
+   * Remember a file that needn't be read again while its guard
+   * macro is defined.
+   */
+
+  GUARDFILE *gp;
+
+  if (isguarded(global, filename))
+    return;                             /* Already known        */
+  gp = (GUARDFILE *) malloc(sizeof (GUARDFILE) + strlen(filename));
+  if (gp == NULL)
+    return;                             /* Just read it again   */
+  strcpy(gp->filename, filename);
+  gp->guard = (guard != NULL) ? savestring(global, guard) : NULL;
+  gp->next = global->guardfiles;
+  global->guardfiles = gp;
+}
+
+FILE_LOCAL
+int isguarded(struct Global *global, char *filename)
+{
+  /*
+   * Return TRUE if including the file would have no effect.
+   */
+
+  GUARDFILE *gp;
+
+  for (gp = global->guardfiles; gp != NULL; gp = gp->next) {
+    if (streq(gp->filename, filename))
+      return (gp->guard == NULL || symlookup(global, gp->guard) != NULL);
+  }
+  return (FALSE);
+}
+
 ReturnCode addfile(struct Global *global,
                    FILE *fp,            /* Open file pointer */
                    char *filename)      /* Name of the file  */
@@ -2246,10 +2775,13 @@ int dooptions(struct Global *global, struct fppTag *tags)
     case FPPTAG_DEFINE:
       /*
        * If the option is just "-Dfoo", make it -Dfoo=1
+       * Split a copy as the caller's string may be shared.
        */
       {
-        char *symbol=(char *)tags->data;
+        char *symbol=savestring(global, (char *)tags->data);
         char *text=symbol;
+        if(!symbol)
+          return(FPP_OUT_OF_MEMORY);
         while (*text != EOS && *text != '=')
           text++;
         if (*text == EOS)
@@ -2260,9 +2792,11 @@ int dooptions(struct Global *global, struct fppTag *tags)
          * Now, save the word and its definition.
          */
         dp = defendel(global, symbol, FALSE);
+        if(dp)
+          dp->repl = savestring(global, text);
+        free(symbol);
         if(!dp)
           return(FPP_OUT_OF_MEMORY);
-        dp->repl = savestring(global, text);
         dp->nargs = DEF_NOARGS;
       }
       break;
@@ -2344,6 +2878,10 @@ int dooptions(struct Global *global, struct fppTag *tags)
       global->wflag++;
       break;
     case FPPTAG_INPUT_NAME:
+      if (strlen(tags->data) > NWORK) {
+        cfatal(global, FATAL_FILENAME_BUFFER_OVERFLOW);
+        return(FPP_FILENAME_BUFFER_OVERFLOW);
+      }
       strcpy(global->work, tags->data);    /* Remember input filename */
       global->first_file=tags->data;
       break;
@@ -2371,6 +2909,53 @@ int dooptions(struct Global *global, struct fppTag *tags)
     case FPPTAG_ALLOW_INCLUDE_LOCAL:
       global->allowincludelocal=(tags->data?1:0);
       break;
+    case FPPTAG_DEPENDS:
+      global->depends=(void (*)(char *, void *))tags->data;
+      break;
+    case FPPTAG_INPUT_BUFFER:
+      global->inbuffer=(char *)tags->data;
+      break;
+    case FPPTAG_INPUT_BUFFER_SIZE:
+      global->inbuffersize=(size_t)tags->data;
+      break;
+    case FPPTAG_OUTPUT_BLOCK:
+      global->outputblock=(void (*)(char *, int, void *))tags->data;
+      break;
+    case FPPTAG_OUTPUT_TOKEN:
+      global->outputtoken=(void (*)(int, size_t, size_t, void *))tags->data;
+      break;
+    case FPPTAG_OPENFILE:
+      global->openfunc=(char *(*)(char *, size_t *, void *))tags->data;
+      break;
+    case FPPTAG_DUMPMACROS:
+      global->dumpmacros=(void (*)(struct fppMacro *, void *))tags->data;
+      break;
+    case FPPTAG_MACROS:
+      {
+        struct fppMacro *macro;
+        for (macro = (struct fppMacro *)tags->data; macro->name; macro++) {
+          dp = defendel(global, macro->name, FALSE);
+          if(!dp)
+            return(FPP_OUT_OF_MEMORY);
+          dp->repl = macro->repl ? savestring(global, macro->repl) : NULL;
+          dp->nargs = macro->nargs;
+        }
+      }
+      break;
+    case FPPTAG_DUMPGUARDS:
+      global->dumpguards=(void (*)(struct fppGuard *, void *))tags->data;
+      break;
+    case FPPTAG_GUARDS:
+      {
+        /* Added oldest first so that the list keeps its order */
+        struct fppGuard *guard = (struct fppGuard *)tags->data;
+        int n;
+        for (n = 0; guard[n].filename; n++)
+          ;
+        while (--n >= 0)
+          addguardfile(global, guard[n].filename, guard[n].guard);
+      }
+      break;
     default:
       cwarn(global, WARN_INTERNAL_ERROR, NULL);
       break;
@@ -2395,12 +2980,12 @@ ReturnCode initdefines(struct Global *global)
   char **pp;
   char *tp;
   DEFBUF *dp;
-  struct tm *tm;
+  struct tm tm;                 /* Not localtime()'s shared one */
 
   int i;
   time_t tvec;
 
-  static char months[12][4] = {
+  static const char months[12][4] = {
     "Jan", "Feb", "Mar", "Apr", "May", "Jun",
     "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
     };
@@ -2445,11 +3030,15 @@ ReturnCode initdefines(struct Global *global)
     dp->repl = tp;
     dp->nargs = DEF_NOARGS;
     time(&tvec);
-    tm = localtime(&tvec);
+#if defined(_WIN32)
+    localtime_s(&tm, &tvec);
+#else
+    localtime_r(&tvec, &tm);
+#endif
     sprintf(tp, "\"%3s %2d %4d\"",      /* "Aug 20 1988" */
-            months[tm->tm_mon],
-            tm->tm_mday,
-            tm->tm_year + 1900);
+            months[tm.tm_mon],
+            tm.tm_mday,
+            tm.tm_year + 1900);
 
     /*
      * Define __TIME__ as this moment's time.
@@ -2461,9 +3050,9 @@ ReturnCode initdefines(struct Global *global)
     dp->repl = tp;
     dp->nargs = DEF_NOARGS;
     sprintf(tp, "\"%2d:%02d:%02d\"",    /* "20:42:31" */
-            tm->tm_hour,
-            tm->tm_min,
-            tm->tm_sec);
+            tm.tm_hour,
+            tm.tm_min,
+            tm.tm_sec);
 #endif
   }
   return(FPP_OK);
@@ -3395,7 +3984,7 @@ ReturnCode eval(struct Global *global, int *eval)
 	}
 	opp->op = op;
 	opp->prec = prec;
-	skip = (valp[-1] != 0);         /* Short-circuit tester */
+	skip = (valp > value && valp[-1] != 0); /* Short-circuit tester */
 	/*
 	 * Do the short-circuit stuff here.  Short-circuiting
 	 * stops automagically when operators are evaluated.
@@ -4102,6 +4691,153 @@ void skipnl(struct Global *global)
   return;
 }
 
+FILE_LOCAL
+int skipinactive(struct Global *global)
+{
+  /*
+   * Skip the lines of a false #if group without reading them through
+   * get(), when they come straight from a file held in memory.  Lines
+   * are searched with memchr() for a leading '#' and only comments,
+   * line splices and the directives control() ignores while skipping
+   * are understood.  Input is left at the start of any other directive,
+   * such as the #else, #elif or #endif ending the group or a nested
+   * conditional, or at a line that needs a closer look, for the normal
+   * path to take over.  Returns the number of lines skipped, as counted
+   * by cppmain().
+   */
+
+  FILEINFO *file = global->infile;
+  char *p, *end, *eol, *q;
+  char *resume;         /* Where the normal path takes over     */
+  int lines = 0;        /* All newlines passed over             */
+  int counter = 0;      /* Newlines that end a line             */
+  int wrongline = FALSE; /* Newline in comment or continuation  */
+  int resumelines = 0, resumecounter = 0, resumewrongline = FALSE;
+  int lead;             /* Only white space so far on the line  */
+  int n;
+
+  if (file == NULL || file->fp == NULL || file->mend == NULL
+      || *file->bptr != EOS || global->nestcomments || global->warnnestcomments)
+    return (0);
+
+  p = resume = file->mptr;
+  end = file->mend;
+  lead = TRUE;
+  while (p < end) {
+    if (lead && p != resume) {
+      /*
+       * The normal path can take over here.
+       */
+      resume = p;
+      resumelines = lines;
+      resumecounter = counter;
+      resumewrongline = wrongline;
+    }
+    if (lead) {
+      for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'
+                           || *p == '\f' || *p == VT))
+          p++;
+        /*
+         * A backslash-newline joins the next line on to this one,
+         * which may still start with a directive.
+         */
+        if (p >= end || *p != '\\')
+          break;
+        for (q = p + 1; q < end && *q == '\r'; q++)
+          ;
+        if (q >= end || *q != '\n')
+          break;
+        p = q + 1;
+        lines++;
+        wrongline = TRUE;
+      }
+      if (p < end && *p == '#') {
+        for (q = p + 1; q < end && (*q == ' ' || *q == '\t'); q++)
+          ;
+        for (n = 0; q + n < end && (type[q[n] & 0xFF] == LET
+                                    || (n > 0 && type[q[n] & 0xFF] == DIG)); n++)
+          ;
+        if (q + n < end && (q[n] == '\\' || (n == 0 && q[n] == '/')))
+          break;                        /* Too hard to read     */
+        /*
+         * Only directives that control() passes over without a
+         * look are skipped here.  Conditionals have to be seen to
+         * keep its #if nesting and checks, and it writes unknown
+         * directives to the output even in a false group.
+         */
+        if (n == 0) {
+          if (q < end && *q != '\n' && type[*q & 0xFF] != DIG)
+            break;                      /* #123 is a #line      */
+        }
+        else if (!((n == 4 && (!memcmp(q, "line", 4)))
+                   || (n == 5 && (!memcmp(q, "undef", 5) || !memcmp(q, "error", 5)))
+                   || (n == 6 && (!memcmp(q, "define", 6) || !memcmp(q, "pragma", 6)
+                                  || !memcmp(q, "assert", 6)))
+                   || (n == 7 && !memcmp(q, "include", 7))))
+          break;
+        p = q + n;
+        lead = FALSE;
+      }
+      else if (p + 1 >= end || p[0] != '/' || p[1] != '*')
+        lead = FALSE;                   /* Comments are spaces  */
+    }
+
+    if ((eol = (char *) memchr(p, '\n', end - p)) == NULL)
+      break;                            /* Unterminated line    */
+
+    /*
+     * Step over any comments on the rest of the line.
+     */
+    q = (char *) memchr(p, '/', eol - p);
+    if (q != NULL && q[1] == '*') {
+      for (p = q + 2; ; p++) {
+        if ((p = (char *) memchr(p, '*', end - p)) == NULL)
+          goto done;                    /* Unterminated comment */
+        if (p + 1 < end && p[1] == '/')
+          break;
+      }
+      for (n = 0; (q = (char *) memchr(q, '\n', p - q)) != NULL; q++)
+        n++;
+      p += 2;
+      lines += n;
+      if (n > 0)
+        wrongline = TRUE;
+      continue;
+    }
+    if (q != NULL && (q[1] != '/' || !global->cplusplus)) {
+      p = q + 1;                        /* Just a slash         */
+      continue;
+    }
+
+    /*
+     * A backslash before the newline joins the next line on to this
+     * one, unless it ends a // comment.
+     */
+    if (q == NULL) {
+      for (q = eol; q > p && q[-1] == '\r'; q--)
+        ;
+      if (q > p && q[-1] == '\\') {
+        p = eol + 1;
+        lines++;
+        wrongline = TRUE;
+        continue;
+      }
+    }
+    p = eol + 1;
+    lines++;
+    counter++;
+    lead = TRUE;
+  }
+
+ done:
+  file->mptr = resume;
+  global->line += resumelines;
+  if (resumewrongline)
+    global->wrongline = TRUE;
+  return (resumecounter);
+}
+
 int skipws(struct Global *global)
 {
   /*
@@ -4480,6 +5216,11 @@ ReturnCode getfile(struct Global *global,
   (*file)->filename = savestring(global, name); /* Save file/macro name */
   (*file)->progname = NULL;                     /* No #line seen yet    */
   (*file)->unrecur = 0;                         /* No macro fixup       */
+  (*file)->mptr = NULL;                         /* Not read from memory */
+  (*file)->mend = NULL;
+  (*file)->guardstate = GUARD_START;            /* No directives yet    */
+  (*file)->guarddepth = 0;
+  (*file)->guard = NULL;
   (*file)->bptr = (*file)->buffer;              /* Initialize line ptr  */
   (*file)->buffer[0] = EOS;                     /* Force first read     */
   (*file)->line = 0;                            /* (Not used just yet)  */
@@ -4502,13 +5243,12 @@ DEFBUF *lookid(struct Global *global,
    * If found, returns the table pointer;  Else returns NULL.
    */
 
-  int nhash;
-  DEFBUF *dp;
+  unsigned int nhash;
+  DEFBUF **slot;
   int ct;
-  int temp;
   int isrecurse;        /* For #define foo foo  */
 
-  nhash = 0;
+  nhash = SYM_HASH_SEED;
   if ((isrecurse = (c == DEF_MAGIC)))   /* If recursive macro   */
     c = get(global);                    /* hack, skip DEF_MAGIC */
   ct = 0;
@@ -4516,22 +5256,98 @@ DEFBUF *lookid(struct Global *global,
     if (ct == global->tokenbsize)
       global->tokenbuf = realloc(global->tokenbuf, 1 + (global->tokenbsize *= 2));
     global->tokenbuf[ct++] = c;         /* Store token byte     */
-    nhash += c;                         /* Update hash value    */
+    nhash = SYM_HASH(nhash, c);         /* Update hash value    */
     c = get(global);
   }  while (type[c] == LET || type[c] == DIG);
   unget(global);                        /* Rescan terminator    */
   global->tokenbuf[ct] = EOS;           /* Terminate token      */
   if (isrecurse)                        /* Recursive definition */
     return(NULL);                       /* undefined just now   */
-  nhash += ct;                          /* Fix hash value       */
-  dp = global->symtab[nhash % SBSIZE];  /* Starting bucket      */
-  while (dp != (DEFBUF *) NULL) {       /* Search symbol table  */
-    if (dp->hash == nhash               /* Fast precheck        */
-        && (temp = strcmp(dp->name, global->tokenbuf)) >= 0)
-      break;
-    dp = dp->link;                      /* Nope, try next one   */
+  slot = symfind(global, global->tokenbuf, nhash, FALSE);
+  return((slot != NULL) ? *slot : NULL);
+}
+
+FILE_LOCAL
+DEFBUF **symfind(struct Global *global,
+                 char *name,
+                 unsigned int nhash,    /* SYM_HASH() of name   */
+                 int insert)            /* TRUE for a free slot */
+{
+  /*
+   * Search the open addressed symbol table for name, probing linearly
+   * from its hash. Returns the slot holding the symbol or, if it isn't
+   * in the table, NULL. When insert is TRUE and the symbol isn't found,
+   * the first free slot on the probe sequence is returned instead.
+   */
+
+  DEFBUF **slot;
+  DEFBUF **freeslot = NULL;
+  unsigned int mask = global->symsize - 1;
+  unsigned int i;
+
+  for (i = nhash & mask; ; i = (i + 1) & mask) {
+    slot = &global->symtab[i];
+    if (*slot == NULL)                  /* End of the probe     */
+      return(insert ? (freeslot ? freeslot : slot) : NULL);
+    if (*slot == SYM_DELETED) {         /* Reusable slot        */
+      if (freeslot == NULL)
+        freeslot = slot;
+    } else if ((*slot)->hash == nhash   /* Fast precheck        */
+               && !strcmp((*slot)->name, name))
+      return(slot);
+  }
+}
+
+FILE_LOCAL
+DEFBUF *symlookup(struct Global *global, char *name)
+{
+  /*
+   * Find a symbol by name, returning NULL if it isn't defined.
+   */
+
+  DEFBUF **slot;
+  unsigned int nhash;
+  char *np;
+
+  for (nhash = SYM_HASH_SEED, np = name; *np != EOS; np++)
+    nhash = SYM_HASH(nhash, *np);
+  slot = symfind(global, name, nhash, FALSE);
+  return ((slot != NULL) ? *slot : NULL);
+}
+
+FILE_LOCAL
+ReturnCode symgrow(struct Global *global)
+{
+  /*
+   * Double the size of the symbol table, dropping deleted slots.
+   */
+
+  DEFBUF **oldtab = global->symtab;
+  int oldsize = global->symsize;
+  DEFBUF *dp;
+  unsigned int mask;
+  unsigned int i;
+  int j;
+
+  global->symtab = (DEFBUF **) calloc(oldsize * 2, sizeof(DEFBUF *));
+  if (global->symtab == NULL) {
+    global->symtab = oldtab;
+    return(FPP_OUT_OF_MEMORY);
+  }
+  global->symsize = oldsize * 2;
+  global->symused = 0;
+  mask = global->symsize - 1;
+  for (j = 0; j < oldsize; j++) {
+    dp = oldtab[j];
+    if (dp != NULL && dp != SYM_DELETED) {
+      for (i = dp->hash & mask; global->symtab[i] != NULL; i = (i + 1) & mask)
+        ;
+      global->symtab[i] = dp;
+      global->symused++;
+    }
   }
-  return((temp == 0) ? dp : NULL);
+  free(oldtab);
+  return(FPP_OK);
 }
 
 DEFBUF *defendel(struct Global *global,
@@ -4546,36 +5362,31 @@ DEFBUF *defendel(struct Global *global,
    */
 
   DEFBUF *dp;
-  DEFBUF **prevp;
+  DEFBUF **slot;
   char *np;
-  int nhash;
-  int temp;
+  unsigned int nhash;
   int size;
 
-  for (nhash = 0, np = name; *np != EOS;)
-    nhash += *np++;
+  for (nhash = SYM_HASH_SEED, np = name; *np != EOS; np++)
+    nhash = SYM_HASH(nhash, *np);
   size = (np - name);
-  nhash += size;
-  prevp = &global->symtab[nhash % SBSIZE];
-  while ((dp = *prevp) != (DEFBUF *) NULL) {
-    if (dp->hash == nhash
-        && (temp = strcmp(dp->name, name)) >= 0) {
-      if (temp > 0)
-        dp = NULL;                      /* Not found            */
-      else {
-        *prevp = dp->link;              /* Found, unlink and    */
-        if (dp->repl != NULL)           /* Free the replacement */
-          free(dp->repl);               /* if any, and then     */
-        free((char *) dp);              /* Free the symbol      */
-      }
-      break;
-    }
-    prevp = &dp->link;
+  dp = NULL;                            /* Not found            */
+  if ((slot = symfind(global, name, nhash, FALSE)) != NULL) {
+    dp = *slot;                         /* Found, unlink and    */
+    *slot = SYM_DELETED;
+    if (dp->repl != NULL)               /* Free the replacement */
+      free(dp->repl);                   /* if any, and then     */
+    free((char *) dp);                  /* Free the symbol      */
   }
   if (!delete) {
+    if ((global->symused + 1) * 2 > global->symsize
+        && symgrow(global) && global->symused + 1 >= global->symsize)
+      return(NULL);                     /* No room left         */
+    slot = symfind(global, name, nhash, TRUE);
+    if (*slot == NULL)
+      global->symused++;
     dp = (DEFBUF *) malloc((int) (sizeof (DEFBUF) + size));
-    dp->link = *prevp;
-    *prevp = dp;
+    *slot = dp;
     dp->hash = nhash;
     dp->repl = NULL;
     dp->nargs = 0;
@@ -4588,15 +5399,13 @@ DEFBUF *defendel(struct Global *global,
 void outdefines(struct Global *global)
 {
   DEFBUF *dp;
-  DEFBUF **syp;
+  int i;
 
   deldefines(global);                   /* Delete built-in #defines     */
-  for (syp = global->symtab; syp < &global->symtab[SBSIZE]; syp++) {
-    if ((dp = *syp) != (DEFBUF *) NULL) {
-      do {
-        outadefine(global, dp);
-      } while ((dp = dp->link) != (DEFBUF *) NULL);
-    }
+  for (i = 0; i < global->symsize; i++) {
+    dp = global->symtab[i];
+    if (dp != NULL && dp != SYM_DELETED)
+      outadefine(global, dp);
   }
 }
 
@@ -4666,6 +5475,42 @@ void outadefine(struct Global *global, DEFBUF *dp)
   Putchar(global, '\n');
 }
 
+FILE_LOCAL
+char *memgets(char *buffer, int size, FILEINFO *file)
+{
+  /*
+   * Read the next line of a file held in memory, like fgets() but
+   * dropping carriage returns as they aren't white space to cpp.
+   * Returns NULL at the end of the memory.
+   */
+
+  char *end;
+  char *from;
+  char *to;
+  int length;
+
+  if (file->mptr >= file->mend)
+    return (NULL);
+  length = file->mend - file->mptr;
+  if (length > size - 1)
+    length = size - 1;
+  /* Find the end of the line, or the most that fits in the buffer */
+  if ((end = (char *) memchr(file->mptr, '\n', length)) != NULL)
+    length = end - file->mptr + 1;
+  if (memchr(file->mptr, '\r', length) == NULL) {
+    memcpy(buffer, file->mptr, length);
+    to = buffer + length;
+  } else {
+    for (from = file->mptr, to = buffer; from < file->mptr + length; from++) {
+      if (*from != '\r')
+        *to++ = *from;
+    }
+  }
+  *to = EOS;
+  file->mptr += length;
+  return (buffer);
+}
+
 /*
  *                      G E T
  */
@@ -4713,16 +5558,21 @@ int get(struct Global *global)
        * from that certain file!
        */
 
-      if(global->input && global->first_file && !strcmp(global->first_file, file->filename))
+      if(file->mend != NULL)
+        file->bptr = memgets(file->buffer, NBUFF, file);
+      else if(global->input && global->first_file && !strcmp(global->first_file, file->filename))
         file->bptr = global->input(file->buffer, NBUFF, global->userdata);
       else
         file->bptr = fgets(file->buffer, NBUFF, file->fp);
       if(file->bptr != NULL) {
         goto newline;           /* process the line     */
       } else {
-        if(!(global->input && global->first_file && !strcmp(global->first_file, file->filename)))
+        if(file->mend == NULL &&
+           !(global->input && global->first_file && !strcmp(global->first_file, file->filename)))
           /* If the input function isn't user supplied, close the file! */
           fclose(file->fp);           /* Close finished file  */
+        if (file->guardstate == GUARD_DONE) /* Whole file guarded */
+          addguardfile(global, file->filename, file->guard);
         if ((global->infile = file->parent) != NULL) {
           /*
            * There is an "ungotten" newline in the current
@@ -4742,6 +5592,8 @@ int get(struct Global *global)
     free(file->filename);               /* Free name and        */
     if (file->progname != NULL)         /* if a #line was seen, */
       free(file->progname);             /* free it, too.        */
+    if (file->guard != NULL)            /* Guard name too       */
+      free(file->guard);
     free(file);                         /* Free file space      */
     if (global->infile == NULL)         /* If at end of file    */
       return (EOF_CHAR);                /* Return end of file   */
@@ -5053,10 +5905,8 @@ void domsg(struct Global *global,
         MSG_PREFIX, tp, global->infile->fp?global->line:file->line, severity);
   if(global->error)
     global->error(global->userdata, ErrorMessage[error], arg);
-#if defined(UNIX)
   else
     vfprintf(stderr, ErrorMessage[error], arg);
-#endif
   Error(global, "\n");
 
   if (file)   /*OIS*0.92*/
@@ -5085,6 +5935,7 @@ void cerror(struct Global *global,
   va_list arg;
   va_start(arg, message);
   domsg(global, message, arg);
+  va_end(arg);
 }
 
 void Error(struct Global *global, char *format, ...)
@@ -5098,8 +5949,7 @@ void Error(struct Global *global, char *format, ...)
   va_start(arg, format);
   if(global->error)
     global->error(global->userdata, format, arg);
-#if defined(UNIX)
   else
     vfprintf(stderr, format, arg);
-#endif
+  va_end(arg);
 }
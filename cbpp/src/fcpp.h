@@ -1,4 +1,7 @@
 
+#ifndef INCLUDED_FCPP_H
+#define INCLUDED_FCPP_H
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -10,6 +13,19 @@ struct fppTag {
   void *data;
 };
 
+/* A macro definition in fcpp's internal form, see FPPTAG_DUMPMACROS */
+struct fppMacro {
+  char *name;
+  int nargs;          /* -1 if defined without an argument list */
+  char *repl;         /* Replacement text, may be NULL */
+};
+
+/* A file that needn't be read again, see FPPTAG_DUMPGUARDS */
+struct fppGuard {
+  char *filename;     /* Name the file was opened as */
+  char *guard;        /* Include guard macro, NULL for #pragma once */
+};
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -128,9 +144,63 @@ struct fppTag {
 /* Allow include "X" (rather than <X>) to search local files, default is TRUE */
 #define FPPTAG_ALLOW_INCLUDE_LOCAL 34
 
+/* Function called with the name and user data for every include file opened */
+#define FPPTAG_DEPENDS 35 /* data is function pointer to a
+			   "void (*)(char *, void *)" */
+
+/* Main input file contents held in memory, read in place of FPPTAG_INPUT.
+   Carriage returns are stripped as lines are read */
+#define FPPTAG_INPUT_BUFFER 36 /* data is char pointer */
+
+/* Size of the FPPTAG_INPUT_BUFFER contents in bytes */
+#define FPPTAG_INPUT_BUFFER_SIZE 37 /* data is size cast to a pointer */
+
+/* Output function receiving blocks of characters, used instead of FPPTAG_OUTPUT */
+#define FPPTAG_OUTPUT_BLOCK 38 /* data is function pointer to a
+			   "void (*)(char *, int, void *)" */
+
+/* Function returning the contents of an include file, used instead of opening
+   it. Returns NULL if it can't be read, otherwise the contents must stay valid
+   until fppPreProcess returns */
+#define FPPTAG_OPENFILE 39 /* data is function pointer to a
+			   "char *(*)(char *, size_t *, void *)" */
+
+/* Function called once preprocessing ends with every macro still defined,
+   other than the built-in ones */
+#define FPPTAG_DUMPMACROS 40 /* data is function pointer to a
+			   "void (*)(struct fppMacro *, void *)" */
+
+/* Macros to define before preprocessing, as reported by FPPTAG_DUMPMACROS */
+#define FPPTAG_MACROS 41 /* data is an array of struct fppMacro ended by one
+			   with a NULL name */
+
+/* Function called with the type, output offset and length of each name,
+   number and string literal written, in output order. Names and numbers
+   written with nothing between them are reported as one span of the type
+   of the first */
+#define FPPTAG_OUTPUT_TOKEN 42 /* data is function pointer to a
+			   "void (*)(int, size_t, size_t, void *)" */
+
+/* Function called once preprocessing ends with every file found to have an
+   include guard or #pragma once, most recent first */
+#define FPPTAG_DUMPGUARDS 43 /* data is function pointer to a
+			   "void (*)(struct fppGuard *, void *)" */
+
+/* Guarded files to skip when included, as reported by FPPTAG_DUMPGUARDS */
+#define FPPTAG_GUARDS 44 /* data is an array of struct fppGuard ended by one
+			   with a NULL filename */
+
+/* Token span types reported by FPPTAG_OUTPUT_TOKEN */
+#define FPP_TOKEN_NAME 1
+#define FPP_TOKEN_NUMBER 2
+#define FPP_TOKEN_STRING 3
+
 int fppPreProcess(struct fppTag *);
 
 
 #ifdef __cplusplus
 }
 #endif
+
+
+#endif
@@ -0,0 +1,115 @@
+
+#
+# Times cbpp on generated kernels with thousands of texture and surface parameters, checking that the
+# cost of each reference stays flat as their number grows, rather than growing with it.
+#
+# Each kernel takes 8 texture/surface parameters of mixed types, so every size generates the same
+# handful of texture types shared by many references, along with a global and local definition per
+# reference and a binary kernel parameter table.
+#
+# Usage: python TextureRefsBench.py <path to cbpp> [--sizes 2000,8000,24000,48000] [--target cuda]
+#                                   [--repeat 3] [--max-growth 2.0]
+#
+# Prints the best time of each size and exits with 1 if the time per reference of the largest size
+# is more than max-growth times that of the smallest. The time of a run without any references is
+# taken off each size first. Sizes need to be large: the lookups that scanned every reference only
+# took more than twice as long per reference from around 32000 references.
+#
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+
+PARAM_TYPES = [
+	"Texture3Dn<short>",
+	"Texture2Du<unsigned int>",
+	"Texture1Dn<float>",
+	"Surface2D",
+	"Texture2Dn<char>",
+	"Surface3D",
+]
+
+PARAMS_PER_KERNEL = 8
+
+
+def GenerateKernels(nb_refs):
+	lines = []
+	for kernel in range((nb_refs + PARAMS_PER_KERNEL - 1) // PARAMS_PER_KERNEL):
+		params = []
+		for i in range(PARAMS_PER_KERNEL):
+			params.append("%s p%d" % (PARAM_TYPES[(kernel + i) % len(PARAM_TYPES)], i))
+		lines.append("cmp_kernel_fn void K%d(%s, int n)" % (kernel, ", ".join(params)))
+		lines.append("{")
+		lines.append("\tint i = 0;")
+		lines.append("}")
+		lines.append("")
+	return "\n".join(lines)
+
+
+def TimeRun(cbpp, directory, target, repeat):
+	command = [
+		cbpp, os.path.join(directory, "kernels.cu"),
+		"-target", target,
+		"-noheader",
+		"-output", os.path.join(directory, "kernels.out"),
+		"-output_bin", os.path.join(directory, "kernels.bin"),
+	]
+
+	best = None
+	for i in range(repeat):
+		start = time.time()
+		result = subprocess.call(command)
+		elapsed = time.time() - start
+		if result != 0:
+			sys.exit("ERROR: cbpp failed with exit code %d" % result)
+		best = elapsed if best is None else min(best, elapsed)
+	return best
+
+
+def Main():
+	parser = argparse.ArgumentParser(description="Time cbpp with increasing numbers of texture references")
+	parser.add_argument("cbpp", help="Path to the cbpp executable")
+	parser.add_argument("--sizes", default="2000,8000,24000,48000", help="Comma-separated numbers of references")
+	parser.add_argument("--target", default="cuda", help="Target passed to cbpp")
+	parser.add_argument("--repeat", type=int, default=3, help="Runs per size, keeping the fastest")
+	parser.add_argument("--max-growth", type=float, default=2.0, help="Allowed growth in time per reference")
+	args = parser.parse_args()
+
+	sizes = [int(size) for size in args.sizes.split(",")]
+	directory = tempfile.mkdtemp(prefix="cbpp_bench_")
+	try:
+		# Time taken by a run with no references, such as starting the process, isn't counted against
+		# them, otherwise it makes each larger size look cheaper per reference than the last
+		with open(os.path.join(directory, "kernels.cu"), "w") as f:
+			f.write(GenerateKernels(0))
+		startup = TimeRun(args.cbpp, directory, args.target, args.repeat)
+		print("Start-up: %.3f seconds" % startup)
+
+		print("%10s %10s %14s %8s" % ("refs", "seconds", "us per ref", "growth"))
+		first_per_ref = None
+		per_ref = None
+		for size in sizes:
+			with open(os.path.join(directory, "kernels.cu"), "w") as f:
+				f.write(GenerateKernels(size))
+
+			elapsed = TimeRun(args.cbpp, directory, args.target, args.repeat)
+			per_ref = max(elapsed - startup, 0.000001) / size
+			if first_per_ref is None:
+				first_per_ref = per_ref
+			print("%10d %10.3f %14.2f %8.2f" % (size, elapsed, per_ref * 1000000, per_ref / first_per_ref))
+	finally:
+		shutil.rmtree(directory)
+
+	if per_ref > first_per_ref * args.max_growth:
+		print("ERROR: Time per reference grew by more than %.1fx" % args.max_growth)
+		return 1
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(Main())
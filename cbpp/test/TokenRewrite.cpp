@@ -0,0 +1,430 @@
+
+//
+// Checks the token rewrite edits of ComputeProcessor on small parsed inputs. After every batch of
+// edits the token list is walked from its head to make sure it's linked in both directions, that its
+// ordinals strictly increase and that it holds exactly the tokens the nodes own, in the same order.
+//
+// Edits that break the rules of the API are checked to be refused with an error.
+//
+// Usage: token_rewrite
+//
+
+
+#include "../src/ComputeProcessor.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+namespace
+{
+	int g_NbFailures = 0;
+
+
+	#define CHECK(condition) Check(condition, #condition, __LINE__)
+
+
+	void Check(bool condition, const char* text, int line)
+	{
+		if (!condition)
+		{
+			fprintf(stderr, "ERROR: TokenRewrite.cpp(%d): Check failed: %s\n", line, text);
+			g_NbFailures++;
+		}
+	}
+
+
+	//
+	// A parsed input, kept with the arguments and text the processor needs
+	//
+	struct Parse
+	{
+		Parse(const char* text)
+			: args(2, argv)
+			, data(text, text + strlen(text))
+			, processor(args, "rewrite.c", data, std::vector<TokenSpan>(), ComputeTarget_CUDA)
+		{
+			parsed = processor.ParseFile();
+		}
+
+		static const char* argv[2];
+
+		Arguments args;
+		std::vector<char> data;
+		ComputeProcessor processor;
+		bool parsed;
+	};
+	const char* Parse::argv[2] = { "token_rewrite", "rewrite.c" };
+
+
+	struct EmitText : public INodeVisitor
+	{
+		bool Visit(const ComputeProcessor& processor, cmpNode& node)
+		{
+			for (TokenIterator i(node); i; ++i)
+				text.append(i.token->start, i.token->length);
+			return true;
+		}
+
+		std::string text;
+	};
+
+
+	cmpToken* FirstTokenInTree(cmpNode* node)
+	{
+		if (node->first_token != 0)
+			return node->first_token;
+		for (cmpNode* child = node->first_child; child != 0; child = child->next_sibling)
+		{
+			if (cmpToken* token = FirstTokenInTree(child))
+				return token;
+		}
+		return 0;
+	}
+
+
+	// Text of the nodes, checking it matches the text of the token list and that the list is well-formed
+	std::string Text(Parse& parse)
+	{
+		EmitText emit;
+		parse.processor.VisitNodes(&emit);
+
+		std::string list_text;
+		cmpToken* prev_token = 0;
+		for (cmpToken* token = FirstTokenInTree(parse.processor.RootNode()); token != 0; token = token->next)
+		{
+			CHECK(token->prev == prev_token);
+			CHECK(prev_token == 0 || prev_token->ordinal < token->ordinal);
+			list_text.append(token->start, token->length);
+			prev_token = token;
+		}
+
+		CHECK(list_text == emit.text);
+		return emit.text;
+	}
+
+
+	TokenList Symbols(const char* text)
+	{
+		// One symbol token for each space-separated word
+		TokenList tokens;
+		while (*text != 0)
+		{
+			const char* end = strchr(text, ' ');
+			if (end == 0)
+				end = text + strlen(text);
+			tokens.Add(cmpToken_Symbol, text, (cmpU32)(end - text), 1);
+			text = *end == ' ' ? end + 1 : end;
+		}
+		return tokens;
+	}
+
+
+	cmpNode* Child(cmpNode* node, int index)
+	{
+		cmpNode* child = node->first_child;
+		while (index-- > 0)
+			child = child->next_sibling;
+		return child;
+	}
+
+
+	// Root children: "int a", ";", "\n", "int b", ";", "\n", "void f" and "\n", with the function's
+	// children being its parameters and then its statement block
+	const char* INPUT = "int a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}\n";
+
+
+	void ReplaceAtHead()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* statement = Child(parse.processor.RootNode(), 0);
+
+		TokenList tokens = Symbols("float");
+		parse.processor.ReplaceTokens(statement, statement->first_token, statement->first_token, tokens);
+		parse.processor.ApplyRewrites();
+
+		CHECK(Text(parse) == "float a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}\n");
+		CHECK(statement->first_token->prev == 0);
+		CHECK(statement->first_token->length == 5);
+	}
+
+
+	void ReplaceAtTail()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* eol = parse.processor.RootNode()->last_child;
+
+		TokenList tokens = Symbols("/**/");
+		parse.processor.ReplaceTokens(eol, eol->first_token, eol->last_token, tokens);
+		parse.processor.ApplyRewrites();
+
+		CHECK(Text(parse) == "int a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}/**/");
+		CHECK(eol->first_token == eol->last_token);
+		CHECK(eol->last_token->next == 0);
+	}
+
+
+	void InsertAtHeadAndTail()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* root = parse.processor.RootNode();
+		cmpNode* first = root->first_child;
+		cmpNode* last = root->last_child;
+
+		TokenList head = Symbols("#pragma");
+		TokenList tail = Symbols("//");
+		cmpNode* head_node = parse.processor.InsertNodeBefore(first, head);
+		cmpNode* tail_node = parse.processor.InsertNodeAfter(last, tail);
+		parse.processor.ApplyRewrites();
+
+		CHECK(Text(parse) == "#pragmaint a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}\n//");
+		CHECK(root->first_child == head_node && head_node->next_sibling == first);
+		CHECK(root->last_child == tail_node && tail_node->prev_sibling == last);
+		CHECK(head_node->first_token->prev == 0);
+		CHECK(tail_node->last_token->next == 0);
+	}
+
+
+	void DeleteThenAppendAtTail()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* eol = parse.processor.RootNode()->last_child;
+
+		// The node is left empty, so appending to it has to find where its tokens go
+		parse.processor.DeleteTokens(eol, eol->first_token, eol->last_token);
+		parse.processor.ApplyRewrites();
+		CHECK(Text(parse) == "int a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}");
+		CHECK(eol->first_token == 0 && eol->last_token == 0);
+
+		TokenList tokens = Symbols("end");
+		parse.processor.AppendTokens(eol, tokens);
+		parse.processor.ApplyRewrites();
+		CHECK(Text(parse) == "int a;\nint b;\nvoid f(int x)\n{\n\tint c;\n}end");
+		CHECK(eol->last_token->next == 0);
+	}
+
+
+	void EditsAcrossNodeBoundaries()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* root = parse.processor.RootNode();
+		cmpNode* statement = Child(root, 0);
+		cmpNode* semicolon = Child(root, 1);
+		cmpNode* function = Child(root, 6);
+		cmpNode* params = function->first_child;
+		cmpNode* block = params->next_sibling;
+		cmpNode* inner_statement = block->first_child;
+
+		// Adjacent ranges at the end of one node and the start of the next can be queued together
+		TokenList name = Symbols("A");
+		TokenList end = Symbols(":");
+		parse.processor.ReplaceTokens(statement, statement->last_token, statement->last_token, name);
+		parse.processor.ReplaceTokens(semicolon, semicolon->first_token, semicolon->last_token, end);
+
+		// Deleting all of a node's tokens and then editing its neighbour
+		TokenList value = Symbols("=0;");
+		parse.processor.DeleteTokens(inner_statement, inner_statement->first_token, inner_statement->last_token);
+		parse.processor.ReplaceTokens(inner_statement->next_sibling, inner_statement->next_sibling->first_token, inner_statement->next_sibling->last_token, value);
+
+		// Appending to a node with children puts the tokens before those of the children
+		TokenList attribute = Symbols("/*attr*/");
+		parse.processor.AppendTokens(function, attribute);
+		parse.processor.ApplyRewrites();
+
+		CHECK(Text(parse) == "int A:\nint b;\nvoid f/*attr*/(int x)\n{\n\t=0;\n}\n");
+		CHECK(statement->last_token->next == semicolon->first_token);
+		CHECK(inner_statement->first_token == 0 && inner_statement->last_token == 0);
+		CHECK(function->last_token->next == params->first_token);
+	}
+
+
+	void EditsAreDeferred()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* root = parse.processor.RootNode();
+		cmpNode* statement = Child(root, 3);
+		cmpToken* type_token = statement->first_token;
+		cmpToken* name_token = statement->last_token;
+
+		// Tokens found before queueing edits stay valid until they're applied
+		TokenList first = Symbols("x");
+		TokenList second = Symbols("y");
+		TokenList type = Symbols("long");
+		parse.processor.AppendTokens(statement, first);
+		parse.processor.AppendTokens(statement, second);
+		parse.processor.ReplaceTokens(statement, type_token, type_token, type);
+		CHECK(first.first == 0 && second.first == 0);
+		CHECK(Text(parse) == INPUT);
+		CHECK(statement->first_token == type_token && statement->last_token == name_token);
+
+		// Applied in the order they were made
+		parse.processor.ApplyRewrites();
+		CHECK(Text(parse) == "int a;\nlong bxy;\nvoid f(int x)\n{\n\tint c;\n}\n");
+	}
+
+
+	struct MatchText
+	{
+		MatchText(const char* text)
+			: text(text)
+		{
+		}
+
+		bool operator () (const cmpToken& token) const
+		{
+			return token.length == strlen(text) && !strncmp(token.start, text, token.length);
+		}
+
+		const char* text;
+	};
+
+
+	bool IsNumberedFromStart(Parse& parse)
+	{
+		// Whether every token has the ordinal the whole list is numbered with
+		cmpU64 ordinal = 0;
+		for (cmpToken* token = FirstTokenInTree(parse.processor.RootNode()); token != 0; token = token->next)
+		{
+			ordinal += CMP_TOKEN_ORDINAL_GAP;
+			if (token->ordinal != ordinal)
+				return false;
+		}
+		return true;
+	}
+
+
+	void GapRunsOut()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* statement = Child(parse.processor.RootNode(), 3);
+		cmpToken* name_token = statement->last_token;
+
+		// Each node goes before the last, halving the gap after the "\n" that precedes them until it's
+		// used up and the list has to be numbered again
+		cmpNode* node = statement;
+		bool renumbered = false;
+		std::string nodes_text;
+		for (int i = 0; i < 64; i++)
+		{
+			TokenList tokens = Symbols("n");
+			node = parse.processor.InsertNodeBefore(node, tokens);
+			parse.processor.ApplyRewrites();
+			nodes_text += "n";
+
+			CHECK(Text(parse) == "int a;\n" + nodes_text + "int b;\nvoid f(int x)\n{\n\tint c;\n}\n");
+			renumbered |= IsNumberedFromStart(parse);
+		}
+		CHECK(renumbered);
+
+		// Order comparisons and seeks within a node still work on the new numbering
+		TokenList name = Symbols("b0 b1");
+		parse.processor.ReplaceTokens(statement, name_token, name_token, name);
+		parse.processor.ApplyRewrites();
+		TokenIterator iterator(*statement);
+		cmpToken* b1 = iterator.SeekToken(MatchText("b1"));
+		CHECK(b1 != 0 && b1->ordinal > statement->first_token->ordinal);
+		CHECK(b1 != 0 && b1->ordinal > node->first_token->ordinal);
+		CHECK(iterator.SeekToken(MatchText(";")) == 0);
+	}
+
+
+	void RepeatedAppendsKeepGap()
+	{
+		Parse parse(INPUT);
+		CHECK(parse.parsed);
+		cmpNode* statement = Child(parse.processor.RootNode(), 0);
+		cmpToken* next_token = statement->last_token->next;
+		cmpU64 next_ordinal = next_token->ordinal;
+
+		// New tokens are packed at the start of the gap, so appending at the same place many times
+		// neither runs out of it nor renumbers the tokens around it
+		std::string appended_text;
+		for (int i = 0; i < 10000; i++)
+		{
+			TokenList tokens = Symbols("x");
+			parse.processor.AppendTokens(statement, tokens);
+			parse.processor.ApplyRewrites();
+			appended_text += "x";
+		}
+
+		CHECK(Text(parse) == "int a" + appended_text + ";\nint b;\nvoid f(int x)\n{\n\tint c;\n}\n");
+		CHECK(next_token->ordinal == next_ordinal);
+		CHECK(statement->last_token->ordinal < next_ordinal);
+	}
+
+
+	void RejectOverlap()
+	{
+		Parse parse(INPUT);
+		cmpNode* statement = Child(parse.processor.RootNode(), 0);
+
+		// "int a" and then " a", which is refused leaving the first edit to apply
+		TokenList first = Symbols("x");
+		TokenList second = Symbols("y");
+		parse.processor.ReplaceTokens(statement, statement->first_token, statement->last_token, first);
+		bool rejected = false;
+		try
+		{
+			parse.processor.ReplaceTokens(statement, statement->first_token->next, statement->last_token, second);
+		}
+		catch (const cmpError& error)
+		{
+			rejected = strstr(cmpError_Text(&error), "overlap") != 0;
+		}
+		CHECK(rejected);
+		CHECK(second.first == 0);
+
+		parse.processor.ApplyRewrites();
+		CHECK(Text(parse) == "x;\nint b;\nvoid f(int x)\n{\n\tint c;\n}\n");
+	}
+
+
+	void RejectOutsideNode()
+	{
+		Parse parse(INPUT);
+		cmpNode* statement = Child(parse.processor.RootNode(), 0);
+
+		// From "int a" into the ";" node that follows it
+		TokenList tokens = Symbols("x");
+		bool rejected = false;
+		try
+		{
+			parse.processor.ReplaceTokens(statement, statement->first_token, statement->next_sibling->first_token, tokens);
+		}
+		catch (const cmpError& error)
+		{
+			rejected = strstr(cmpError_Text(&error), "within the node") != 0;
+		}
+		CHECK(rejected);
+		CHECK(tokens.first == 0);
+
+		parse.processor.ApplyRewrites();
+		CHECK(Text(parse) == INPUT);
+	}
+}
+
+
+int main()
+{
+	ReplaceAtHead();
+	ReplaceAtTail();
+	InsertAtHeadAndTail();
+	DeleteThenAppendAtTail();
+	EditsAcrossNodeBoundaries();
+	EditsAreDeferred();
+	GapRunsOut();
+	RepeatedAppendsKeepGap();
+	RejectOverlap();
+	RejectOutsideNode();
+
+	printf("%d checks failed\n", g_NbFailures);
+	return g_NbFailures == 0 ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+
+//
+// Checks that skipping false #if groups in files held in memory, which doesn't read them a character
+// at a time, gives the same output and messages as reading the same text through an input function.
+// Some inputs also check for the output or messages that the preprocessor is known to give.
+//
+// Usage: fcpp_inactive
+//
+
+
+#include "../src/fcpp.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+
+namespace
+{
+	struct Result
+	{
+		Result(const char* input)
+			: input(input)
+			, position(input)
+		{
+		}
+
+		const char* input;
+		const char* position;
+		std::string output;
+		std::string messages;
+	};
+
+
+	char* InputLine(char* buffer, int size, void* user_data)
+	{
+		// Hands the input over a line at a time, the same way fgets() would
+		Result& result = *(Result*)user_data;
+		if (*result.position == 0)
+			return 0;
+		int length = 0;
+		while (length < size - 1 && result.position[length] != 0 && result.position[length++] != '\n')
+			;
+		memcpy(buffer, result.position, length);
+		buffer[length] = 0;
+		result.position += length;
+		return buffer;
+	}
+
+
+	void OutputBlock(char* data, int size, void* user_data)
+	{
+		((Result*)user_data)->output.append(data, size);
+	}
+
+
+	void Error(void* user_data, char* format, va_list args)
+	{
+		char text[1024];
+		vsnprintf(text, sizeof(text), format, args);
+		((Result*)user_data)->messages += text;
+	}
+
+
+	void PreProcess(Result& result, bool in_memory)
+	{
+		fppTag tags[] =
+		{
+			{ FPPTAG_USERDATA, &result },
+			{ FPPTAG_INPUT_NAME, (void*)"inactive.c" },
+			{ FPPTAG_OUTPUT_BLOCK, (void*)OutputBlock },
+			{ FPPTAG_ERROR, (void*)Error },
+			{ FPPTAG_SHOWVERSION, (void*)FALSE },
+			{ FPPTAG_END, 0 },
+			{ FPPTAG_END, 0 },
+			{ FPPTAG_END, 0 },
+		};
+
+		// The input is either held in memory or read through the input function
+		fppTag* tag = tags + sizeof(tags) / sizeof(tags[0]) - 3;
+		if (in_memory)
+		{
+			tag[0].tag = FPPTAG_INPUT_BUFFER;
+			tag[0].data = (void*)result.input;
+			tag[1].tag = FPPTAG_INPUT_BUFFER_SIZE;
+			tag[1].data = (void*)strlen(result.input);
+		}
+		else
+		{
+			tag[0].tag = FPPTAG_INPUT;
+			tag[0].data = (void*)InputLine;
+		}
+
+		fppPreProcess(tags);
+	}
+
+
+	// Runs the input both ways, returning false if the results differ or don't contain the given text
+	bool Check(const char* name, const char* input, const char* expected_output, const char* expected_message)
+	{
+		Result in_memory(input), read(input);
+		PreProcess(in_memory, true);
+		PreProcess(read, false);
+
+		const char* difference = 0;
+		if (in_memory.output != read.output)
+			difference = "output differs";
+		else if (in_memory.messages != read.messages)
+			difference = "messages differ";
+		else if (expected_output != 0 && in_memory.output.find(expected_output) == std::string::npos)
+			difference = "output is missing text";
+		else if (expected_message != 0 && in_memory.messages.find(expected_message) == std::string::npos)
+			difference = "messages are missing text";
+		if (difference == 0)
+			return true;
+
+		fprintf(stderr, "ERROR: %s: %s\n", name, difference);
+		fprintf(stderr, "In memory output:\n%s\nIn memory messages:\n%s\n", in_memory.output.c_str(), in_memory.messages.c_str());
+		fprintf(stderr, "Read output:\n%s\nRead messages:\n%s\n", read.output.c_str(), read.messages.c_str());
+		return false;
+	}
+}
+
+
+int main()
+{
+	int nb_failures = 0;
+
+	// A line splice in leading white space puts the #endif on the line before, where it ends the group
+	nb_failures += !Check("splice before #endif",
+		"#if 0\n  \\\n#endif\nint b;\n#endif\nint a;\n",
+		"int b;", "#endif must be in an #if");
+	nb_failures += !Check("splice before nested #if",
+		"#if 0\n\\\r\n#if 1\n#endif\nint b;\n#endif\nint a;\n",
+		"int a;", 0);
+	nb_failures += !Check("splices between lines",
+		"#if 0\nint b = \\\n  1;\n\t\\\n\\\n#define B\n#endif\nint a;\n",
+		"int a;", 0);
+
+	// Nested conditionals are still checked while the group they're in is skipped
+	nb_failures += !Check("#else after #else",
+		"#if 0\n#if 1\n#else\n#else\n#endif\n#endif\nint a;\n",
+		"int a;", "#else may not follow #else");
+	nb_failures += !Check("#elif after #else",
+		"#if 0\n#ifdef A\n#else\n#elif 1\n#endif\n#endif\nint a;\n",
+		"int a;", "#elif may not follow #else");
+	nb_failures += !Check("text after nested #endif",
+		"#if 0\n#ifndef A\n#endif A\n#endif\nint a;\n",
+		"int a;", 0);
+	nb_failures += !Check("text after #else",
+		"#if 0\n#else junk\nint a;\n#endif\n",
+		"int a;", 0);
+
+	// Directives that are passed over, or written out, while skipping
+	nb_failures += !Check("ignored directives",
+		"#if 0\n#define A 1\n#  undef A\n#include <none.h>\n#pragma once\n#line 10\n#12\n#\n#error no\n#endif\nint a;\n",
+		"int a;", 0);
+	nb_failures += !Check("unknown directive",
+		"#if 0\n#unknown x\n#if1\n#endif\nint a;\n",
+		"int a;", 0);
+	nb_failures += !Check("comments",
+		"#if 0\n/* #endif\n*/ int b;\n  /* c */ #define X\n#  /* c */ endif\nint a;\n",
+		"int a;", 0);
+
+	printf("%d inputs differed\n", nb_failures);
+	return nb_failures == 0 ? 0 : 1;
+}
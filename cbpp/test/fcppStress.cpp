@@ -0,0 +1,213 @@
+
+//
+// Runs many preprocessings of the same inputs on concurrent threads and checks that every run
+// produces exactly the same output, token spans, messages, macros and guarded files as a run on
+// its own. Any state fcpp shares between runs shows up as a difference.
+//
+// Usage: fcpp_stress [nb_threads] [nb_runs_per_thread]
+//
+
+
+#include "../src/fcpp.h"
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace
+{
+	struct Result
+	{
+		std::string output;
+		std::string messages;
+		std::string tokens;
+		std::string macros;
+		std::string guards;
+	};
+
+
+	std::string g_Input;
+	std::string g_GuardedHeader;
+	std::string g_OnceHeader;
+
+
+	void BuildInputs()
+	{
+		g_GuardedHeader =
+			"#ifndef GUARDED_H\n"
+			"#define GUARDED_H\n"
+			"#define SCALE(x) ((x) * 3)\n"
+			"struct Guarded { int a; };\n"
+			"#endif\n";
+
+		g_OnceHeader =
+			"#pragma once\n"
+			"#define JOIN(a, b) a ## b\n"
+			"#define STR(a) #a\n"
+			"int once_value = SCALE(__LINE__);\n";
+
+		// Enough macros, expansions and includes to keep each run busy while the others run
+		char line[256];
+		g_Input = "#include \"guarded.h\"\n#include \"once.h\"\n#include \"missing.h\"\n";
+		for (int i = 0; i < 400; i++)
+		{
+			sprintf(line, "#define VALUE%d(x) SCALE(x) + %d\n", i, i);
+			g_Input += line;
+			sprintf(line, "int JOIN(value, %d) = VALUE%d(__LINE__);\n", i, i);
+			g_Input += line;
+			sprintf(line, "const char* name%d = STR(VALUE%d(%d));\n", i, i, i);
+			g_Input += line;
+			sprintf(line, "#if (%d %% 3) == 0\nint third%d;\n#else\nint other%d;\n#endif\n", i, i, i);
+			g_Input += line;
+			g_Input += "#include \"guarded.h\"\n#include \"once.h\"\n";
+		}
+	}
+
+
+	char* OpenFile(char* filename, size_t* size, void* user_data)
+	{
+		const std::string* data = 0;
+		const char* name = strrchr(filename, '/');
+		name = name ? name + 1 : filename;
+		if (strcmp(name, "guarded.h") == 0)
+			data = &g_GuardedHeader;
+		else if (strcmp(name, "once.h") == 0)
+			data = &g_OnceHeader;
+		if (data == 0)
+			return 0;
+
+		*size = data->size();
+		return (char*)data->data();
+	}
+
+
+	void OutputBlock(char* data, int size, void* user_data)
+	{
+		((Result*)user_data)->output.append(data, size);
+	}
+
+
+	void OutputToken(int type, size_t start, size_t length, void* user_data)
+	{
+		char text[64];
+		sprintf(text, "%d:%u:%u ", type, (unsigned int)start, (unsigned int)length);
+		((Result*)user_data)->tokens += text;
+	}
+
+
+	void Error(void* user_data, char* format, va_list args)
+	{
+		char text[1024];
+		vsnprintf(text, sizeof(text), format, args);
+		((Result*)user_data)->messages += text;
+	}
+
+
+	void DumpMacro(fppMacro* macro, void* user_data)
+	{
+		Result& result = *(Result*)user_data;
+		char nb_args[16];
+		sprintf(nb_args, "(%d)", macro->nargs);
+		result.macros += std::string(macro->name) + nb_args + (macro->repl ? macro->repl : "") + "\n";
+	}
+
+
+	void DumpGuard(fppGuard* guard, void* user_data)
+	{
+		Result& result = *(Result*)user_data;
+		result.guards += std::string(guard->filename) + ":" + (guard->guard ? guard->guard : "") + "\n";
+	}
+
+
+	bool PreProcess(Result& result)
+	{
+		fppTag tags[] =
+		{
+			{ FPPTAG_USERDATA, &result },
+			{ FPPTAG_INPUT_NAME, (void*)"stress.c" },
+			{ FPPTAG_INPUT_BUFFER, (void*)g_Input.data() },
+			{ FPPTAG_INPUT_BUFFER_SIZE, (void*)g_Input.size() },
+			{ FPPTAG_OUTPUT_BLOCK, (void*)OutputBlock },
+			{ FPPTAG_OUTPUT_TOKEN, (void*)OutputToken },
+			{ FPPTAG_ERROR, (void*)Error },
+			{ FPPTAG_OPENFILE, (void*)OpenFile },
+			{ FPPTAG_DUMPMACROS, (void*)DumpMacro },
+			{ FPPTAG_DUMPGUARDS, (void*)DumpGuard },
+			{ FPPTAG_SHOWVERSION, (void*)FALSE },
+			{ FPPTAG_DEFINE, (void*)"CMP_STRESS=1" },
+			{ FPPTAG_END, 0 },
+		};
+
+		return fppPreProcess(tags) == 0;
+	}
+
+
+	const char* Compare(const Result& a, const Result& b)
+	{
+		if (a.output != b.output)
+			return "output";
+		if (a.messages != b.messages)
+			return "messages";
+		if (a.tokens != b.tokens)
+			return "token spans";
+		if (a.macros != b.macros)
+			return "macros";
+		if (a.guards != b.guards)
+			return "guarded files";
+		return 0;
+	}
+
+
+	void RunThread(const Result* expected, int nb_runs, int* nb_failures)
+	{
+		for (int i = 0; i < nb_runs; i++)
+		{
+			Result result;
+			PreProcess(result);
+			const char* difference = Compare(result, *expected);
+			if (difference != 0)
+			{
+				if ((*nb_failures)++ == 0)
+					fprintf(stderr, "ERROR: A concurrent run produced different %s\n", difference);
+			}
+		}
+	}
+}
+
+
+int main(int argc, const char* argv[])
+{
+	int nb_threads = argc > 1 ? atoi(argv[1]) : 16;
+	int nb_runs = argc > 2 ? atoi(argv[2]) : 20;
+
+	BuildInputs();
+
+	// The result of a run made with nothing else running
+	Result expected;
+	PreProcess(expected);
+	if (expected.output.empty() || expected.guards.empty() || expected.messages.empty())
+	{
+		fprintf(stderr, "ERROR: The reference run didn't produce all of its results\n");
+		return 1;
+	}
+
+	std::vector<std::thread> threads;
+	std::vector<int> nb_failures(nb_threads);
+	for (int i = 0; i < nb_threads; i++)
+		threads.push_back(std::thread(RunThread, &expected, nb_runs, &nb_failures[i]));
+
+	int total_failures = 0;
+	for (int i = 0; i < nb_threads; i++)
+	{
+		threads[i].join();
+		total_failures += nb_failures[i];
+	}
+
+	printf("%d of %d runs differed\n", total_failures, nb_threads * nb_runs);
+	return total_failures == 0 ? 0 : 1;
+}
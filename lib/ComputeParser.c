@@ -111,6 +111,9 @@ struct cmpLexerCursor
 	const char* file_data;
 	cmpU32 file_size;
 
+	// Position that lexing stops at
+	cmpU32 limit;
+
 	// Position within the file
 	cmpU32 position;
 	cmpU32 line;
@@ -135,6 +138,7 @@ cmpError cmpLexerCursor_Create(cmpLexerCursor** cursor, const char* file_data, c
 	// Set defaults
 	(*cursor)->file_data = file_data;
 	(*cursor)->file_size = file_size;
+	(*cursor)->limit = file_size;
 	(*cursor)->position = 0;
 	(*cursor)->line = 1;
 	(*cursor)->line_position = 0;
@@ -180,6 +184,13 @@ cmpError cmpLexerCursor_Error(cmpLexerCursor* cursor)
 }
 
 
+void cmpLexerCursor_SetLimit(cmpLexerCursor* cursor, cmpU32 limit)
+{
+	assert(cursor != NULL);
+	cursor->limit = limit < cursor->file_size ? limit : cursor->file_size;
+}
+
+
 static void cmpLexerCursor_ConsumeChars(cmpLexerCursor* cursor, int size)
 {
 	cmpU32 next_pos;
@@ -188,10 +199,10 @@ static void cmpLexerCursor_ConsumeChars(cmpLexerCursor* cursor, int size)
 
 	// Catches overflow, hitting EOF and errors from any previous calls
 	next_pos = cursor->position + size;
-	if (next_pos >= cursor->file_size)
+	if (next_pos >= cursor->limit)
 	{
 		// Move cursor to the EOF
-		cursor->position = cursor->file_size;
+		cursor->position = cursor->limit;
 		return;
 	}
 
@@ -211,19 +222,28 @@ static const char* cmpLexerCursor_PeekChars(cmpLexerCursor* cursor, cmpU32 looka
 	assert(cursor != NULL);
 
 	// Nothing to read at EOF
-	if (cursor->position + lookahead >= cursor->file_size)
+	if (cursor->position + lookahead >= cursor->limit)
 		return 0;
 
 	return cursor->file_data + cursor->position + lookahead;
 }
 
 
+static cmpBool cmpLexerCursor_AtEnd(cmpLexerCursor* cursor)
+{
+	assert(cursor != NULL);
+
+	// Checked by position as EOF is also a valid char value
+	return cursor->position >= cursor->limit;
+}
+
+
 static char cmpLexerCursor_PeekChar(cmpLexerCursor* cursor, cmpU32 lookahead)
 {
 	assert(cursor != NULL);
 
 	// Nothing to read at EOF
-	if (cursor->position + lookahead >= cursor->file_size)
+	if (cursor->position + lookahead >= cursor->limit)
 		return EOF;
 
 	return cursor->file_data[cursor->position + lookahead];
@@ -341,6 +361,7 @@ cmpError cmpToken_CreateEmpty(cmpToken** token)
 	(*token)->hash = 0;
 	(*token)->prev = NULL;
 	(*token)->next = NULL;
+	(*token)->ordinal = 0;
 
 	return cmpError_CreateOK();
 }
@@ -382,11 +403,13 @@ void cmpToken_AddToList(cmpToken** first_token, cmpToken** last_token, cmpToken*
 
 	if (*first_token == NULL)
 	{
+		token->ordinal = CMP_TOKEN_ORDINAL_GAP;
 		*first_token = token;
 		*last_token = token;
 	}
 	else
 	{
+		token->ordinal = (*last_token)->ordinal + CMP_TOKEN_ORDINAL_GAP;
 		(*last_token)->next = token;
 		token->prev = *last_token;
 		*last_token = token;
@@ -417,7 +440,7 @@ static cmpToken* cmpLexer_ConsumeTokenPred(cmpLexerCursor* cur, enum cmpTokenTyp
 	cmpLexerCursor_ConsumeChars(cur, initial_length);
 
 	// Scan all characters until EOF or the predicate says so
-	while (1)
+	while (!cmpLexerCursor_AtEnd(cur))
 	{
 		char c = cmpLexerCursor_PeekChar(cur, 0);
 		if (!p(cur, token, c, state))
@@ -644,9 +667,9 @@ cmpToken* cmpLexer_ConsumeToken(cmpLexerCursor* cur)
 	char last_c = 0;
 
 	// Read the current character and return an empty token at stream end
-	c = cmpLexerCursor_PeekChar(cur, 0);
-	if (c == EOF)
+	if (cmpLexerCursor_AtEnd(cur))
 		return NULL;
+	c = cmpLexerCursor_PeekChar(cur, 0);
 
 	switch (c)
 	{
@@ -792,6 +815,34 @@ cmpToken* cmpLexer_ConsumeToken(cmpLexerCursor* cur)
 }
 
 
+cmpToken* cmpLexer_ConsumeKnownToken(cmpLexerCursor* cur, enum cmpTokenType type, cmpU32 length)
+{
+	cmpToken* token;
+	cmpError error;
+
+	assert(cur != NULL);
+	assert(length != 0);
+
+	// Nothing left to read at EOF
+	if (cmpLexerCursor_PeekChars(cur, length - 1) == NULL)
+		return NULL;
+
+	error = cmpToken_CreateFromCursor(&token, cur, type, length);
+	if (!cmpError_OK(&error))
+	{
+		cmpLexerCursor_SetError(cur, &error);
+		return NULL;
+	}
+	cmpLexerCursor_ConsumeChars(cur, length);
+
+	// Symbols get the same hash and keyword checks as those that are lexed
+	if (type == cmpToken_Symbol)
+		cmpLexer_IdentifyKeywordTokens(token);
+
+	return token;
+}
+
+
 
 // =====================================================================================================
 // cmpParserCursor
@@ -886,6 +937,41 @@ static cmpToken* cmpParserCursor_PeekToken(cmpParserCursor* cursor, cmpU32 looka
 }
 
 
+static cmpBool cmpToken_IsWhitespace(const cmpToken* token)
+{
+	return token->type == cmpToken_Whitespace || token->type == cmpToken_EOL || token->type == cmpToken_Comment;
+}
+
+
+static cmpToken* cmpParserCursor_PeekNonWhitespaceToken(cmpParserCursor* cursor, cmpU32 lookahead)
+{
+	cmpToken* token;
+
+	assert(cursor != NULL);
+
+	// Seek to the lookahead token, counting only those that aren't whitespace or comments
+	token = cursor->cur_token;
+	while (token != NULL)
+	{
+		if (!cmpToken_IsWhitespace(token))
+		{
+			if (lookahead == 0)
+				break;
+			lookahead--;
+		}
+		token = token->next;
+	}
+
+	if (token != NULL)
+	{
+		cursor->line = token->line;
+		return token;
+	}
+
+	return NULL;
+}
+
+
 static cmpToken* cmpParserCursor_ConsumeToken(cmpParserCursor* cursor)
 {
 	cmpToken* token = cmpParserCursor_PeekToken(cursor, 0);
@@ -1044,6 +1130,32 @@ void cmpNode_AddBefore(cmpNode* before, cmpNode* node)
 }
 
 
+void cmpNode_AddAfter(cmpNode* after, cmpNode* node)
+{
+	assert(after != NULL);
+	assert(node != NULL);
+
+	// Point node to its parent/neighbours
+	node->parent = after->parent;
+	node->prev_sibling = after;
+	node->next_sibling = after->next_sibling;
+
+	// Does this node become the last child?
+	if (node->next_sibling == NULL)
+	{
+		// Only allow insert-after when there is parent node
+		assert(node->parent != NULL);
+		node->parent->last_child = node;
+	}
+	else
+	{
+		node->next_sibling->prev_sibling = node;
+	}
+
+	after->next_sibling = node;
+}
+
+
 
 // =====================================================================================================
 // cmpParser
@@ -1081,6 +1193,7 @@ static cmpNode* cmpParser_ConsumePPDirective(cmpParserCursor* cur)
 
 
 static cmpNode* cmpParser_ConsumeStatementBlock(cmpParserCursor* cur);
+static cmpNode* cmpParser_ConsumeToken(cmpParserCursor* cur);
 
 
 static cmpNode* cmpParser_ConsumeFunctionSpec(cmpParserCursor* cur, enum cmpNodeType type, const char* desc)
@@ -1374,13 +1487,39 @@ static cmpNode* cmpParser_ConsumeStatement(cmpParserCursor* cur)
 }
 
 
+static void cmpParser_ConsumeStructWhitespace(cmpParserCursor* cur, cmpNode* node)
+{
+	// Whitespace between the keywords and name of a struct belongs to the struct node
+	while (1)
+	{
+		cmpToken* token = cmpParserCursor_PeekToken(cur, 0);
+		if (token == NULL || !cmpToken_IsWhitespace(token))
+			break;
+
+		cmpParserCursor_ConsumeToken(cur);
+		node->last_token = token;
+	}
+}
+
+
 static cmpBool cmpParser_ConsumeTypedefStructName(cmpParserCursor* cur, cmpNode* node)
 {
-	cmpToken* token = cmpParserCursor_PeekToken(cur, 0);
+	cmpToken* token = cmpParserCursor_PeekNonWhitespaceToken(cur, 0);
 	if (token != NULL && token->type == cmpToken_Symbol)
 	{
 		cmpNode* child_node;
-		cmpError error = cmpNode_Create(&child_node, cmpNode_StructName, cur);
+		cmpError error;
+
+		// Keep any whitespace before the name in the tree, after the child nodes already added
+		while (cmpParserCursor_PeekToken(cur, 0) != token)
+		{
+			child_node = cmpParser_ConsumeToken(cur);
+			if (child_node == NULL)
+				return CMP_FALSE;
+			cmpNode_AddChild(node, child_node);
+		}
+
+		error = cmpNode_Create(&child_node, cmpNode_StructName, cur);
 		if (!cmpError_OK(&error))
 		{
 			cmpParserCursor_SetError(cur, &error);
@@ -1389,7 +1528,6 @@ static cmpBool cmpParser_ConsumeTypedefStructName(cmpParserCursor* cur, cmpNode*
 
 		cmpParserCursor_ConsumeToken(cur);
 		cmpNode_AddChild(node, child_node);
-		node->type = cmpNode_StructDecl;
 		return CMP_TRUE;
 	}
 
@@ -1414,6 +1552,7 @@ static cmpNode* cmpParser_ConsumeStruct(cmpParserCursor* cur)
 		return NULL;
 	}
 	cmpParserCursor_ConsumeToken(cur);
+	cmpParser_ConsumeStructWhitespace(cur, node);
 
 	// Input can either be "struct" or "typedef struct" so consume the struct
 	next_token = cmpParserCursor_PeekToken(cur, 0);
@@ -1422,6 +1561,7 @@ static cmpNode* cmpParser_ConsumeStruct(cmpParserCursor* cur)
 		cmpParserCursor_ConsumeToken(cur);
 		node->last_token = next_token;
 		name_is_tag = CMP_TRUE;
+		cmpParser_ConsumeStructWhitespace(cur, node);
 	}
 
 	// Consume tag or name
@@ -1453,7 +1593,10 @@ static cmpNode* cmpParser_ConsumeStruct(cmpParserCursor* cur)
 
 	// If a symbol follows, this is a "typedef struct" forward declaration
 	if (name_is_tag && cmpParser_ConsumeTypedefStructName(cur, node))
+	{
+		node->type = cmpNode_StructDecl;
 		return node;
+	}
 
 	// Parse the struct body, if it exists
 	while (1)
@@ -1500,7 +1643,7 @@ static cmpNode* cmpParser_ConsumeTypedef(cmpParserCursor* cur)
 	VLOG(cur, ("* cmpParser_ConsumeTypedef\n"));
 
 	// Redirect as a struct if this is "typedef struct"
-	next_token = cmpParserCursor_PeekToken(cur, 1);
+	next_token = cmpParserCursor_PeekNonWhitespaceToken(cur, 1);
 	if (next_token != NULL && next_token->type == cmpToken_Struct)
 		return cmpParser_ConsumeStruct(cur);
 
@@ -40,6 +40,7 @@ typedef unsigned int cmpBool;
 typedef unsigned char cmpU8;
 typedef unsigned short cmpU16;
 typedef unsigned int cmpU32;
+typedef unsigned long long cmpU64;
 typedef char cmpS8;
 typedef short cmpS16;
 typedef int cmpS32;
@@ -109,6 +110,9 @@ cmpU32 cmpLexerCursor_LinePosition(cmpLexerCursor* cursor);
 
 cmpError cmpLexerCursor_Error(cmpLexerCursor* cursor);
 
+// Lexing stops at the limit as if it were the end of the file, until the limit is moved on
+void cmpLexerCursor_SetLimit(cmpLexerCursor* cursor, cmpU32 limit);
+
 
 
 //
@@ -214,8 +218,15 @@ typedef struct cmpToken
 	// All tokens must be linked in order for the parser to process them
 	struct cmpToken* prev;
 	struct cmpToken* next;
+
+	// Increases along the list so that the order of two tokens is one comparison, with gaps left
+	// between tokens for those inserted later
+	cmpU64 ordinal;
 } cmpToken;
 
+// Ordinal spacing of tokens added to the end of a list
+#define CMP_TOKEN_ORDINAL_GAP ((cmpU64)1 << 32)
+
 cmpError cmpToken_CreateEmpty(cmpToken** token);
 
 cmpError cmpToken_Create(cmpToken** token, enum cmpTokenType type, const char* start, cmpU32 length, cmpU32 line);
@@ -234,6 +245,10 @@ void cmpToken_AddToList(cmpToken** first_token, cmpToken** last_token, cmpToken*
 //
 cmpToken* cmpLexer_ConsumeToken(cmpLexerCursor* cur);
 
+// Consumes a token whose type and length are already known, such as one classified by a preprocessor,
+// without scanning its characters. The token must not contain any EOLs.
+cmpToken* cmpLexer_ConsumeKnownToken(cmpLexerCursor* cur, enum cmpTokenType type, cmpU32 length);
+
 
 
 //
@@ -309,6 +324,8 @@ void cmpNode_AddChild(cmpNode* node, cmpNode* child_node);
 
 void cmpNode_AddBefore(cmpNode* before, cmpNode* node);
 
+void cmpNode_AddAfter(cmpNode* after, cmpNode* node);
+
 cmpNode* cmpParser_ConsumeNode(cmpParserCursor* cur);
 
 void cmpParser_LogNodes(const cmpNode* node, cmpU32 depth);